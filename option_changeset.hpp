@@ -0,0 +1,304 @@
+/**
+ * @file option_changeset.hpp
+ * @author Herwig Letofsky
+ * @brief changesets instead of whole files for shipping modifications to
+ * many hosts. A changeset is a unified diff without context lines, made
+ * from the edits of a Document, preceded by the version of the content it
+ * was made against:
+ *
+ *   # changeset base 5c3a1f0e9b2d4c71
+ *   --- a/service.conf
+ *   +++ b/service.conf
+ *   @@ -12,1 +12,1 @@
+ *   -port=8080
+ *   +port=9090
+ *
+ * patch(1) accepts it as well, applyChangeset() additionally refuses to
+ * apply it to any other content than its base and checks every removed
+ * line.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_CHANGESET_HPP
+#define OPTION_CHANGESET_HPP
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+#include "option_file.hpp"
+#include "option_transaction.hpp"
+
+namespace ofp {
+
+struct Changeset {
+  struct Hunk {
+    std::size_t old_start = 0;  // first line, or line after which to insert
+    std::size_t old_count = 0;
+    std::size_t new_count = 0;
+    // lines with their ' ', '-' or '+' prefix
+    std::vector<std::string_view> lines;
+  };
+
+  // contentVersion() of the content the changeset was made against
+  std::optional<std::uint64_t> base;
+  std::vector<Hunk> hunks;
+};
+
+namespace detail {
+
+constexpr std::string_view kChangesetHeader = "# changeset base ";
+constexpr std::string_view kNoNewline = "\\ No newline at end of file";
+
+// removed original lines [begin, end) and the lines replacing them
+struct Change {
+  std::size_t begin;
+  std::size_t end;
+  std::vector<std::string_view> lines;
+};
+
+inline void appendNumber(std::string& out, std::size_t number) {
+  out += std::to_string(number);
+}
+
+// parses "<start>[,<count>]"
+inline bool parseRange(std::string_view text, std::size_t& start,
+                       std::size_t& count) {
+  std::string range(text);
+  char* end = nullptr;
+  start = std::strtoul(range.c_str(), &end, 10);
+  if (end == range.c_str()) return false;
+  count = 1;
+  if (*end == ',') {
+    const char* begin = end + 1;
+    count = std::strtoul(begin, &end, 10);
+    if (end == begin) return false;
+  }
+  return *end == '\0';
+}
+
+}  // namespace detail
+
+/**
+ * @brief writes the edits of the document as changeset
+ *
+ * @param name file name for the diff headers, without leading slashes
+ * @return changeset, empty if the document is not modified
+ */
+inline std::string makeChangeset(const Document& document,
+                                 std::string_view name) {
+  const std::vector<std::string_view>& lines = document.lines();
+  std::vector<detail::Change> changes;
+  document.forEachEdit([&](std::size_t line,
+                           const std::vector<std::string_view>& inserted,
+                           std::optional<std::string_view> replacement,
+                           bool removed) {
+    detail::Change change{line, line, inserted};
+    if (line < lines.size() && (replacement || removed)) ++change.end;
+    if (replacement) change.lines.push_back(*replacement);
+    if (change.begin == change.end && change.lines.empty()) return;
+    changes.push_back(std::move(change));
+  });
+  if (changes.empty()) return std::string();
+
+  // a last line without newline can only change as a whole
+  if (!document.terminated() && changes.back().begin == lines.size() &&
+      (changes.size() == 1 ||
+       changes[changes.size() - 2].end != lines.size())) {
+    --changes.back().begin;
+    changes.back().lines.insert(changes.back().lines.begin(), lines.back());
+  }
+  std::vector<detail::Change> merged;
+  for (auto& change : changes) {
+    if (!merged.empty() && merged.back().end == change.begin) {
+      merged.back().end = change.end;
+      merged.back().lines.insert(merged.back().lines.end(),
+                                 change.lines.begin(), change.lines.end());
+    } else {
+      merged.push_back(std::move(change));
+    }
+  }
+
+  char base[17];
+  std::snprintf(base, sizeof(base), "%016llx",
+                static_cast<unsigned long long>(
+                    contentVersion(document.original())));
+  while (!name.empty() && name.front() == '/') name.remove_prefix(1);
+  std::string out;
+  out.append(detail::kChangesetHeader.data(), detail::kChangesetHeader.size());
+  out.append(base).append("\n--- a/");
+  out.append(name.data(), name.size()).append("\n+++ b/");
+  out.append(name.data(), name.size()) += '\n';
+
+  std::ptrdiff_t delta = 0;
+  for (auto& change : merged) {
+    std::size_t old_count = change.end - change.begin;
+    std::size_t new_count = change.lines.size();
+    std::size_t new_begin = change.begin + delta;
+    out += "@@ -";
+    detail::appendNumber(out, old_count ? change.begin + 1 : change.begin);
+    out += ',';
+    detail::appendNumber(out, old_count);
+    out += " +";
+    detail::appendNumber(out, new_count ? new_begin + 1 : new_begin);
+    out += ',';
+    detail::appendNumber(out, new_count);
+    out += " @@\n";
+    for (std::size_t line = change.begin; line < change.end; ++line) {
+      out.append("-").append(lines[line].data(), lines[line].size()) += '\n';
+      if (line + 1 == lines.size() && !document.terminated()) {
+        out.append(detail::kNoNewline.data(), detail::kNoNewline.size()) +=
+            '\n';
+      }
+    }
+    for (auto& line : change.lines) {
+      out.append("+").append(line.data(), line.size()) += '\n';
+    }
+    delta += static_cast<std::ptrdiff_t>(new_count) -
+             static_cast<std::ptrdiff_t>(old_count);
+  }
+  return out;
+}
+
+/**
+ * @brief parses a changeset, the lines of the hunks refer to the text
+ *
+ * @return false if the text is no valid unified diff of a single file
+ */
+inline bool parseChangeset(std::string_view text, Changeset& changeset) {
+  changeset = Changeset();
+  bool headers = false;
+  std::size_t old_left = 0, new_left = 0;
+  bool valid = true;
+  forEachLine(text, [&](std::string_view line) {
+    if (!valid) return;
+    if (old_left || new_left) {
+      if (line.compare(0, 1, "\\") == 0) return;  // no newline marker
+      if (line.empty()) line = " ";  // some tools strip the blank
+      char prefix = line[0];
+      valid = prefix == ' '   ? old_left && new_left
+              : prefix == '-' ? old_left > 0
+              : prefix == '+' ? new_left > 0
+                              : false;
+      if (prefix != '+') --old_left;
+      if (prefix != '-') --new_left;
+      changeset.hunks.back().lines.push_back(line);
+      return;
+    }
+    if (line.compare(0, 2, "@@") == 0) {
+      std::size_t end = line.find(" @@", 2);
+      std::size_t plus = line.find(" +", 2);
+      if (!headers || line.compare(0, 4, "@@ -") != 0 ||
+          end == std::string_view::npos || plus == std::string_view::npos ||
+          plus > end) {
+        valid = false;
+        return;
+      }
+      Changeset::Hunk hunk;
+      std::size_t new_start;
+      valid = detail::parseRange(line.substr(4, plus - 4), hunk.old_start,
+                                 hunk.old_count) &&
+              detail::parseRange(line.substr(plus + 2, end - plus - 2),
+                                 new_start, hunk.new_count);
+      old_left = hunk.old_count;
+      new_left = hunk.new_count;
+      changeset.hunks.push_back(std::move(hunk));
+    } else if (line.compare(0, detail::kChangesetHeader.size(),
+                            detail::kChangesetHeader) == 0 &&
+               !headers) {
+      std::string base(line.substr(detail::kChangesetHeader.size()));
+      char* end = nullptr;
+      changeset.base = std::strtoull(base.c_str(), &end, 16);
+      valid = end != base.c_str() && *end == '\0';
+    } else if (line.compare(0, 4, "--- ") == 0) {
+      valid = !headers;
+    } else if (line.compare(0, 4, "+++ ") == 0) {
+      valid = !headers;
+      headers = true;
+    } else if (line.compare(0, 1, "\\") == 0 && !changeset.hunks.empty()) {
+      // "\ No newline at end of file", applied files always end with one
+    } else if (headers && !line.empty()) {
+      valid = false;
+    }
+  });
+  return valid && headers && !old_left && !new_left;
+}
+
+/**
+ * @brief applies the hunks to the document
+ *
+ * @return false if the document does not hold the removed and context
+ * lines at their positions
+ */
+inline bool applyChangeset(Document& document, const Changeset& changeset) {
+  const std::vector<std::string_view>& lines = document.lines();
+  std::size_t next = 0;  // hunks have to be ordered and must not overlap
+  for (auto& hunk : changeset.hunks) {
+    std::size_t pos = hunk.old_count ? hunk.old_start - 1 : hunk.old_start;
+    if (hunk.old_count && hunk.old_start == 0) return false;
+    if (pos < next || pos > lines.size()) return false;
+    for (auto& line : hunk.lines) {
+      std::string_view text = line.substr(1);
+      if (line[0] == '+') {
+        document.insertLine(pos, text);
+        continue;
+      }
+      if (pos >= lines.size() || lines[pos] != text) return false;
+      if (line[0] == '-') document.removeLine(pos);
+      ++pos;
+    }
+    next = pos;
+  }
+  return true;
+}
+
+/**
+ * @brief applies a changeset to the file while holding its lock, the new
+ * content replaces the file like commitTransaction() does
+ *
+ * @param version receives the version of the file after applying the
+ * changeset, or the current version on a conflict
+ * @return conflict if the file is not the base of the changeset or its lines
+ * do not match
+ */
+inline TransactionResult applyChangeset(const char* path,
+                                        const Changeset& changeset,
+                                        std::uint64_t* version = nullptr) {
+  int fd = detail::openLocked(path);
+  if (fd < 0) return TransactionResult::failed;
+  std::string content;
+  if (!detail::readAll(fd, content)) {
+    ::close(fd);
+    return TransactionResult::failed;
+  }
+  if (version) *version = contentVersion(content);
+  Document document(content);
+  if ((changeset.base && *changeset.base != contentVersion(content)) ||
+      !applyChangeset(document, changeset)) {
+    ::close(fd);
+    return TransactionResult::conflict;
+  }
+  if (!document.modified()) {
+    ::close(fd);
+    return TransactionResult::committed;
+  }
+  bool replaced = replaceFile(path, document);
+  ::close(fd);  // releases the lock
+  if (!replaced) return TransactionResult::failed;
+  if (version) *version = contentVersion(document);
+  return TransactionResult::committed;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_CHANGESET_HPP
@@ -0,0 +1,266 @@
+/**
+ * @file option_codegen.hpp
+ * @author Herwig Letofsky
+ * @brief compiles the options of a file into a C++ header, for options which
+ * are fixed at build time. The entries are the ones READ sees, parsed by the
+ * same rules, and end up in constexpr tables behind a compile-time perfect
+ * hash, with a typed accessor for every key:
+ *
+ *   // option_file_parser -f server.conf --codegen server > server.hpp
+ *   #include "server.hpp"
+ *
+ *   static_assert(server::server_port() == 8080);
+ *   constexpr auto host = server::find("db.host");  // std::string_view
+ *   auto timeout = server::get<ofp::Duration>("server.timeout");
+ *
+ * The accessor type follows the value: integers, booleans, floating point
+ * numbers, durations like "250ms", sizes like "64K" and strings otherwise,
+ * see parseValue() in option_schema.hpp. Accessor names are the keys with
+ * every character which is not allowed in an identifier replaced by '_',
+ * names which collide get the index of the key appended.
+ *
+ * The displacements of the perfect hash are searched by the generator and
+ * written into the header, the compiler only places the keys, so headers
+ * with many thousands of keys stay within the constexpr evaluation limits.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_CODEGEN_HPP
+#define OPTION_CODEGEN_HPP
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_perfect_hash.hpp"
+#include "option_schema.hpp"
+
+namespace ofp {
+
+namespace detail {
+
+inline bool isIdentifierChar(char c, bool first) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+         (!first && c >= '0' && c <= '9');
+}
+
+// keywords a sanitized key may turn into, and the names of the header
+inline bool isReservedName(std::string_view name) {
+  static const std::set<std::string_view> kReserved{
+      "alignas",   "alignof",      "and",       "asm",      "auto",
+      "bool",      "break",        "case",      "catch",    "char",
+      "class",     "const",        "constexpr", "continue", "default",
+      "delete",    "do",           "double",    "else",     "enum",
+      "explicit",  "export",       "extern",    "false",    "float",
+      "for",       "friend",       "goto",      "if",       "inline",
+      "int",       "long",         "mutable",   "namespace", "new",
+      "noexcept",  "not",          "nullptr",   "operator", "or",
+      "private",   "protected",    "public",    "register", "return",
+      "short",     "signed",       "sizeof",    "static",   "struct",
+      "switch",    "template",     "this",      "throw",    "true",
+      "try",       "typedef",      "typeid",    "typename", "union",
+      "unsigned",  "using",        "virtual",   "void",     "volatile",
+      "while",     "xor",          "find",      "get",      "kSize",
+      "kKeys",     "kValues",      "kHash",    "kDisplacement"};
+  // names with a double underscore or _ and a capital are reserved as well
+  return kReserved.count(name) || name.find("__") != std::string_view::npos ||
+         (name.size() > 1 && name[0] == '_' && name[1] >= 'A' &&
+          name[1] <= 'Z');
+}
+
+/**
+ * @brief the text as C++ string literal, bytes outside of printable ASCII
+ * as octal escapes, which never take the following character along, and
+ * '?' escaped so "??=" is no trigraph
+ */
+inline std::string stringLiteral(std::string_view text) {
+  std::string literal = "\"";
+  for (char c : text) {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\' || c == '?') {
+      literal += '\\';
+      literal += c;
+    } else if (byte < 0x20 || byte >= 0x7f) {
+      char escape[5];
+      std::snprintf(escape, sizeof(escape), "\\%03o", byte);
+      literal += escape;
+    } else {
+      literal += c;
+    }
+  }
+  return literal + '"';
+}
+
+/**
+ * @brief return type and expression of the accessor of a value
+ */
+inline std::pair<std::string, std::string> typedValue(std::string_view raw) {
+  std::int64_t integer = 0;
+  bool flag = false;
+  double real = 0;
+  Duration duration{};
+  Bytes bytes;
+  if (parseValue(raw, integer)) {
+    if (integer == std::numeric_limits<std::int64_t>::min()) {
+      return {"std::int64_t", "(-9223372036854775807 - 1)"};
+    }
+    return {"std::int64_t", std::to_string(integer)};
+  }
+  if (parseValue(raw, flag)) return {"bool", flag ? "true" : "false"};
+  // from_chars takes "inf" and "nan" as well, which are no literals
+  if (raw.find_first_not_of("0123456789.eE-+") == std::string_view::npos &&
+      parseValue(raw, real)) {
+    // the shortest text which reads back as the same double, digits only
+    // would be an integer literal which may not fit
+    char text[32];
+    char* end = std::to_chars(text, text + sizeof(text), real).ptr;
+    std::string literal(text, end);
+    if (literal.find_first_of(".e") == std::string::npos) literal += ".0";
+    return {"double", literal};
+  }
+  if (parseValue(raw, duration)) {
+    return {"ofp::Duration",
+            "ofp::Duration(" + std::to_string(duration.count()) + ")"};
+  }
+  if (parseValue(raw, bytes)) {
+    return {"ofp::Bytes", "ofp::Bytes{" + std::to_string(bytes.value) + "u}"};
+  }
+  return {"std::string_view", stringLiteral(raw)};
+}
+
+}  // namespace detail
+
+/**
+ * @brief checks if name is a valid namespace for generateHeader(), nested
+ * ones like "app::options" included
+ */
+inline bool isNamespaceName(std::string_view name) {
+  while (true) {
+    std::size_t end = name.find("::");
+    std::string_view part = name.substr(0, end);
+    if (part.empty() || detail::isReservedName(part)) return false;
+    for (std::size_t i = 0; i < part.size(); ++i) {
+      if (!detail::isIdentifierChar(part[i], i == 0)) return false;
+    }
+    if (end == std::string_view::npos) return true;
+    name.remove_prefix(end + 2);
+  }
+}
+
+/**
+ * @brief writes the header for the entries, see the file description
+ *
+ * @param entries key-value pairs, see readEntries()
+ * @param name_space namespace of the tables and accessors, see
+ * isNamespaceName()
+ * @param source file the entries were read from, for the header comment
+ */
+inline void generateHeader(
+    std::ostream& out,
+    const std::vector<std::pair<std::string, std::string>>& entries,
+    std::string_view name_space, std::string_view source) {
+  std::string guard;
+  for (std::size_t i = 0; i < name_space.size(); ++i) {
+    char c = name_space[i];
+    if (c == ':') ++i;  // "::" becomes one '_'
+    guard += c == ':' ? '_'
+                      : (c >= 'a' && c <= 'z' ? static_cast<char>(c - 32) : c);
+  }
+  guard += "_OPTIONS_HPP";
+  std::string size = std::to_string(entries.size());
+
+  out << "// generated by option_file_parser --codegen from "
+      << detail::stringLiteral(source) << ", do not edit\n\n"
+      << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+      << "#include <array>\n#include <cstdint>\n#include <optional>\n"
+      << "#include <string_view>\n\n"
+      << "#include \"option_perfect_hash.hpp\"\n"
+      << "#include \"option_schema.hpp\"\n\n"
+      << "namespace " << name_space << " {\n\n"
+      << "inline constexpr std::size_t kSize = " << size << ";\n\n";
+  if (entries.empty()) {
+    // a perfect hash needs at least one key
+    out << "constexpr std::optional<std::string_view> find(std::string_view) "
+           "{\n  return std::nullopt;\n}\n\n"
+        << "template <typename T>\nstd::optional<T> get(std::string_view) {\n"
+        << "  return std::nullopt;\n}\n\n";
+  } else {
+    out << "inline constexpr std::array<std::string_view, kSize> kKeys{\n";
+    for (auto& entry : entries) {
+      out << "    " << detail::stringLiteral(entry.first) << ",\n";
+    }
+    out << "};\n\n"
+        << "inline constexpr std::array<std::string_view, kSize> kValues{\n";
+    for (auto& entry : entries) {
+      out << "    " << detail::stringLiteral(entry.second) << ",\n";
+    }
+    out << "};\n\n";
+
+    // the displacements are searched here, the compiler only places the keys
+    std::size_t n = entries.size();
+    std::vector<std::string_view> keys;
+    for (auto& entry : entries) keys.push_back(entry.first);
+    std::vector<std::uint32_t> displacement(n);
+    std::vector<std::uint64_t> hashes(n);
+    std::vector<std::size_t> scratch(5 * n);
+    std::unique_ptr<bool[]> taken(new bool[n]());
+    detail::findDisplacements(keys.data(), n, displacement.data(),
+                              hashes.data(), scratch.data(), taken.get());
+    out << "inline constexpr std::array<std::uint32_t, kSize> "
+           "kDisplacement{";
+    for (std::size_t i = 0; i < n; ++i) {
+      out << (i % 10 == 0 ? "\n    " : " ") << displacement[i] << ",";
+    }
+    out << "\n};\n\n"
+        << "inline constexpr ofp::PerfectHash<kSize> kHash{kKeys, "
+           "kDisplacement};\n\n"
+        << "/**\n * @return raw value of the key, std::nullopt if the file "
+           "has no such key\n */\n"
+        << "constexpr std::optional<std::string_view> find(std::string_view "
+           "key) {\n"
+        << "  std::size_t i = kHash.find(key);\n"
+        << "  if (i == kHash.npos) return std::nullopt;\n"
+        << "  return kValues[i];\n}\n\n"
+        << "/**\n * @return value of the key parsed as T, std::nullopt if "
+           "it is missing or not\n * a valid T\n */\n"
+        << "template <typename T>\nstd::optional<T> get(std::string_view key) "
+           "{\n"
+        << "  auto raw = find(key);\n  T value{};\n"
+        << "  if (!raw || !ofp::parseValue(*raw, value)) return "
+           "std::nullopt;\n"
+        << "  return value;\n}\n\n";
+  }
+
+  std::set<std::string> names;
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    std::string name;
+    for (char c : entries[i].first) {
+      name += detail::isIdentifierChar(c, name.empty()) ? c : '_';
+    }
+    if (name.empty()) name = "option";
+    while (detail::isReservedName(name) || names.count(name)) {
+      name += "_" + std::to_string(i);
+    }
+    names.insert(name);
+    auto typed = detail::typedValue(entries[i].second);
+    out << "// " << detail::stringLiteral(entries[i].first) << "\n"
+        << "constexpr " << typed.first << " " << name << "() { return "
+        << typed.second << "; }\n";
+  }
+  out << "\n}  // namespace " << name_space << "\n\n#endif  // " << guard
+      << "\n";
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_CODEGEN_HPP
@@ -0,0 +1,600 @@
+/**
+ * @file option_compressed.hpp
+ * @author Herwig Letofsky
+ * @brief gzip and zstd compressed option files, selected by the file name
+ * ending in ".gz" or ".zst". READ decompresses chunk by chunk into the line
+ * parser and keeps only the requested keys, so memory does not grow with
+ * the file. Files which are edited are decompressed completely, edited as a
+ * Document and written back compressed.
+ *
+ * gzip support requires zlib (link with -lz), zstd support requires libzstd
+ * (link with -lzstd), reading uses a second thread on machines with more
+ * than one CPU (link with -pthread).
+ * Both are enabled if their header is found, define OFP_WITH_ZLIB=0 or
+ * OFP_WITH_ZSTD=0 to build without them.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_COMPRESSED_HPP
+#define OPTION_COMPRESSED_HPP
+
+#ifndef OFP_WITH_ZLIB
+#if __has_include(<zlib.h>)
+#define OFP_WITH_ZLIB 1
+#else
+#define OFP_WITH_ZLIB 0
+#endif
+#endif
+
+#ifndef OFP_WITH_ZSTD
+#if __has_include(<zstd.h>)
+#define OFP_WITH_ZSTD 1
+#else
+#define OFP_WITH_ZSTD 0
+#endif
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if OFP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#if OFP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "option_document.hpp"
+#include "option_file.hpp"
+#include "option_journal.hpp"
+
+namespace ofp {
+
+enum class Compression : uint8_t { none = 0x00, gzip, zstd };
+
+/**
+ * @return compression of the file, by the ending of its name
+ */
+inline Compression compressionOf(std::string_view path) {
+  auto endsWith = [path](std::string_view suffix) {
+    return path.size() > suffix.size() &&
+           path.substr(path.size() - suffix.size()) == suffix;
+  };
+  if (endsWith(".gz")) return Compression::gzip;
+  if (endsWith(".zst")) return Compression::zstd;
+  return Compression::none;
+}
+
+/**
+ * @return false if the library for the compression is not part of the build
+ */
+inline bool compressionSupported(Compression compression) {
+  switch (compression) {
+    case Compression::gzip:
+      return OFP_WITH_ZLIB;
+    case Compression::zstd:
+      return OFP_WITH_ZSTD;
+    default:
+      return true;
+  }
+}
+
+namespace detail {
+
+/**
+ * @brief a single thread which runs one job after the other, so a job per
+ * chunk does not start a thread per chunk
+ */
+class Worker {
+ public:
+  Worker() : thread_([this] { run(); }) {}
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+
+  // finishes the job in progress
+  ~Worker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+  }
+
+  /**
+   * @brief starts the job, the previous one has to be waited for
+   */
+  void post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = std::move(job);
+      done_ = false;
+    }
+    changed_.notify_all();
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return done_; });
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      changed_.wait(lock, [this] { return job_ || stop_; });
+      if (!job_) return;
+      std::function<void()> job = std::move(job_);
+      job_ = nullptr;
+      lock.unlock();
+      job();
+      lock.lock();
+      done_ = true;
+      changed_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::function<void()> job_;
+  bool done_ = true;
+  bool stop_ = false;
+  std::thread thread_;  // last, it runs on the members above
+};
+
+}  // namespace detail
+
+/**
+ * @brief streaming decompression of a file. Concatenated gzip members and
+ * zstd frames are read as one stream, like gzip -d and zstd -d do.
+ */
+class DecompressingReader {
+ public:
+  static constexpr std::size_t kChunkSize = 256 * 1024;
+
+  DecompressingReader() = default;
+  DecompressingReader(const DecompressingReader&) = delete;
+  DecompressingReader& operator=(const DecompressingReader&) = delete;
+  ~DecompressingReader() { close(); }
+
+  /**
+   * @return false if the file can not be opened or the compression is not
+   * supported
+   */
+  bool open(const char* path, Compression compression) {
+    close();
+    if (compression == Compression::none ||
+        !compressionSupported(compression)) {
+      return false;
+    }
+    fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) return false;
+    compression_ = compression;
+    input_.resize(kChunkSize);
+    done_ = false;
+    complete_ = false;
+    error_ = false;
+#if OFP_WITH_ZLIB
+    if (compression_ == Compression::gzip) {
+      std::memset(&gzip_, 0, sizeof(gzip_));
+      // 32 added to the window bits detects the gzip header
+      if (inflateInit2(&gzip_, 15 + 32) != Z_OK) {
+        close();
+        return false;
+      }
+    }
+#endif
+#if OFP_WITH_ZSTD
+    if (compression_ == Compression::zstd) {
+      zstd_ = ZSTD_createDStream();
+      zstd_input_ = ZSTD_inBuffer{input_.data(), 0, 0};
+      if (!zstd_ || ZSTD_isError(ZSTD_initDStream(zstd_))) {
+        close();
+        return false;
+      }
+    }
+#endif
+    return true;
+  }
+
+  void close() {
+#if OFP_WITH_ZLIB
+    if (compression_ == Compression::gzip) inflateEnd(&gzip_);
+#endif
+#if OFP_WITH_ZSTD
+    if (zstd_) ZSTD_freeDStream(zstd_);
+    zstd_ = nullptr;
+#endif
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    compression_ = Compression::none;
+  }
+
+  /**
+   * @brief decompresses the next part of the file
+   *
+   * @return number of bytes, 0 at the end of the file, -1 for read errors
+   * and corrupt or truncated files
+   */
+  ssize_t read(char* buffer, std::size_t size) {
+    if (done_ || size == 0) return 0;
+#if OFP_WITH_ZLIB
+    if (compression_ == Compression::gzip) return readGzip(buffer, size);
+#endif
+#if OFP_WITH_ZSTD
+    if (compression_ == Compression::zstd) return readZstd(buffer, size);
+#endif
+    return -1;
+  }
+
+  /**
+   * @brief calls fn(line) for every line of the decompressed file, without
+   * the newline. The view is only valid during the call. With more than one
+   * CPU the next chunk is decompressed by a second thread while fn() parses
+   * the current one.
+   *
+   * @return false for read errors and corrupt or truncated files
+   */
+  template <typename Fn>
+  bool forEachLine(Fn fn) {
+    std::vector<char> chunks[2] = {std::vector<char>(kChunkSize),
+                                   std::vector<char>(kChunkSize)};
+    std::string partial;  // line continued by the next chunk
+    int current = 0;
+    ssize_t size = read(chunks[current].data(), kChunkSize);
+    ssize_t next_size = 0;
+    // after the chunks, it is stopped before they are freed
+    std::optional<detail::Worker> worker;
+    if (std::thread::hardware_concurrency() > 1) worker.emplace();
+    while (size > 0) {
+      auto readNext = [this, &chunks, &next_size, current] {
+        next_size = read(chunks[1 - current].data(), kChunkSize);
+      };
+      if (worker) worker->post(readNext);
+      const char* pos = chunks[current].data();
+      const char* end = pos + size;
+      while (pos < end) {
+        auto newline =
+            static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        if (!newline) {
+          partial.append(pos, end - pos);
+          break;
+        }
+        if (partial.empty()) {
+          fn(std::string_view(pos, newline - pos));
+        } else {
+          partial.append(pos, newline - pos);
+          fn(std::string_view(partial));
+          partial.clear();
+        }
+        pos = newline + 1;
+      }
+      if (worker) {
+        worker->wait();
+      } else {
+        readNext();
+      }
+      size = next_size;
+      current = 1 - current;
+    }
+    if (size < 0) return false;
+    if (!partial.empty()) fn(std::string_view(partial));
+    return true;
+  }
+
+ private:
+  // reads the next block of compressed input, false at the end of the file
+  bool fill(std::size_t& available) {
+    ssize_t result = ::read(fd_, input_.data(), input_.size());
+    if (result <= 0) {
+      if (result < 0) error_ = true;
+      return false;
+    }
+    available = result;
+    return true;
+  }
+
+#if OFP_WITH_ZLIB
+  ssize_t readGzip(char* buffer, std::size_t size) {
+    gzip_.next_out = reinterpret_cast<Bytef*>(buffer);
+    gzip_.avail_out = size;
+    while (gzip_.avail_out == size) {
+      int result = inflate(&gzip_, Z_NO_FLUSH);
+      if (result == Z_STREAM_END) {
+        inflateReset(&gzip_);  // a further member may follow
+        complete_ = true;
+      } else if (result == Z_OK) {
+        complete_ = false;
+      } else if (result != Z_BUF_ERROR) {
+        return -1;
+      }
+      if (gzip_.avail_out < size || gzip_.avail_in > 0) continue;
+      std::size_t available = 0;
+      if (!fill(available)) {
+        if (error_ || !complete_) return -1;
+        done_ = true;
+        break;
+      }
+      gzip_.next_in = reinterpret_cast<Bytef*>(input_.data());
+      gzip_.avail_in = available;
+    }
+    return size - gzip_.avail_out;
+  }
+#endif
+
+#if OFP_WITH_ZSTD
+  ssize_t readZstd(char* buffer, std::size_t size) {
+    ZSTD_outBuffer output{buffer, size, 0};
+    while (output.pos == 0) {
+      std::size_t consumed = zstd_input_.pos;
+      std::size_t result = ZSTD_decompressStream(zstd_, &output, &zstd_input_);
+      if (ZSTD_isError(result)) return -1;
+      if (output.pos > 0 || zstd_input_.pos > consumed) {
+        complete_ = result == 0;  // a frame has been finished
+      }
+      if (output.pos > 0 || zstd_input_.pos < zstd_input_.size) continue;
+      std::size_t available = 0;
+      if (!fill(available)) {
+        if (error_ || !complete_) return -1;
+        done_ = true;
+        break;
+      }
+      zstd_input_ = ZSTD_inBuffer{input_.data(), available, 0};
+    }
+    return output.pos;
+  }
+#endif
+
+  int fd_ = -1;
+  Compression compression_ = Compression::none;
+  std::vector<char> input_;
+  bool done_ = false;
+  bool complete_ = false;  // input ended with a complete member or frame
+  bool error_ = false;
+#if OFP_WITH_ZLIB
+  z_stream gzip_;
+#endif
+#if OFP_WITH_ZSTD
+  ZSTD_DStream* zstd_ = nullptr;
+  ZSTD_inBuffer zstd_input_{nullptr, 0, 0};
+#endif
+};
+
+/**
+ * @brief streaming compression into a file descriptor
+ */
+class CompressingWriter {
+ public:
+  CompressingWriter() = default;
+  CompressingWriter(const CompressingWriter&) = delete;
+  CompressingWriter& operator=(const CompressingWriter&) = delete;
+  ~CompressingWriter() { close(); }
+
+  bool open(int fd, Compression compression) {
+    close();
+    if (compression == Compression::none ||
+        !compressionSupported(compression)) {
+      return false;
+    }
+    fd_ = fd;
+    compression_ = compression;
+    output_.resize(DecompressingReader::kChunkSize);
+#if OFP_WITH_ZLIB
+    if (compression_ == Compression::gzip) {
+      std::memset(&gzip_, 0, sizeof(gzip_));
+      // 16 added to the window bits writes a gzip header
+      if (deflateInit2(&gzip_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        compression_ = Compression::none;
+        return false;
+      }
+    }
+#endif
+#if OFP_WITH_ZSTD
+    if (compression_ == Compression::zstd) {
+      zstd_ = ZSTD_createCStream();
+      if (!zstd_ || ZSTD_isError(ZSTD_initCStream(zstd_, 3))) {
+        close();
+        return false;
+      }
+    }
+#endif
+    return true;
+  }
+
+  void close() {
+#if OFP_WITH_ZLIB
+    if (compression_ == Compression::gzip) deflateEnd(&gzip_);
+#endif
+#if OFP_WITH_ZSTD
+    if (zstd_) ZSTD_freeCStream(zstd_);
+    zstd_ = nullptr;
+#endif
+    compression_ = Compression::none;
+  }
+
+  /**
+   * @return false on write errors, errno is set
+   */
+  bool write(std::string_view data) { return compress(data, false); }
+
+  /**
+   * @brief flushes the end of the compressed stream
+   *
+   * @return false on write errors, errno is set
+   */
+  bool finish() { return compress(std::string_view(), true); }
+
+ private:
+  bool flush(std::size_t size) {
+    std::size_t written = 0;
+    while (written < size) {
+      ssize_t result = ::write(fd_, output_.data() + written, size - written);
+      if (result < 0) return false;
+      written += result;
+    }
+    return true;
+  }
+
+  bool compress(std::string_view data, bool last) {
+#if OFP_WITH_ZLIB
+    if (compression_ == Compression::gzip) {
+      gzip_.next_in =
+          reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+      gzip_.avail_in = data.size();
+      int result = Z_OK;
+      do {
+        gzip_.next_out = reinterpret_cast<Bytef*>(output_.data());
+        gzip_.avail_out = output_.size();
+        result = deflate(&gzip_, last ? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_STREAM_ERROR ||
+            !flush(output_.size() - gzip_.avail_out)) {
+          return false;
+        }
+      } while (gzip_.avail_out == 0 || (last && result != Z_STREAM_END));
+      return true;
+    }
+#endif
+#if OFP_WITH_ZSTD
+    if (compression_ == Compression::zstd) {
+      ZSTD_inBuffer input{data.data(), data.size(), 0};
+      std::size_t remaining = 0;
+      do {
+        ZSTD_outBuffer output{output_.data(), output_.size(), 0};
+        remaining = ZSTD_compressStream2(zstd_, &output, &input,
+                                         last ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(remaining) || !flush(output.pos)) return false;
+      } while (input.pos < input.size || (last && remaining != 0));
+      return true;
+    }
+#endif
+    (void)data;
+    (void)last;
+    return false;
+  }
+
+  int fd_ = -1;
+  Compression compression_ = Compression::none;
+  std::vector<char> output_;
+#if OFP_WITH_ZLIB
+  z_stream gzip_;
+#endif
+#if OFP_WITH_ZSTD
+  ZSTD_CStream* zstd_ = nullptr;
+#endif
+};
+
+/**
+ * @brief key-value pairs of a compressed file as READ sees them, see
+ * readEntries(), decompressed chunk by chunk. Only the keys selected by
+ * wanted(key) are kept, so memory depends on them and not on the file.
+ *
+ * @return false if the file can not be read
+ */
+template <typename F = EqualsFormat, typename Wanted>
+bool readCompressedEntries(
+    const char* path, Compression compression, Wanted wanted,
+    std::vector<std::pair<std::string, std::string>>& entries) {
+  DecompressingReader reader;
+  if (!reader.open(path, compression)) return false;
+  entries.clear();
+  std::unordered_map<std::string, std::size_t> positions;
+  std::string section;
+  std::string qualified;  // reused for every line, to save allocations
+  // records count as journal only if nothing else follows them
+  JournalState journal;
+  std::string_view name, key, value;
+  bool removed = false;
+  bool ok = reader.forEachLine([&](std::string_view line) {
+    if (F::kComment == '#' && !line.empty() && line[0] == '#' &&
+        lineIsJournalRecord(line)) {
+      if (!parseJournalRecord(line, key, value, removed)) return;
+      qualified.assign(key.data(), key.size());
+      if (!wanted(qualified)) return;
+      auto& entry = journal[qualified];
+      if (removed) {
+        entry.reset();
+      } else {
+        entry = std::string(value);
+      }
+      return;
+    }
+    if (!journal.empty()) journal.clear();
+    if (lineIsSection(line, name)) {
+      section.assign(name.data(), name.size());
+    } else if (splitLine<F>(line, key, value)) {
+      qualified.assign(section);
+      if (!section.empty()) qualified += '.';
+      qualified.append(key.data(), key.size());
+      if (!wanted(qualified)) return;
+      auto position = positions.emplace(qualified, entries.size());
+      if (position.second) {
+        entries.emplace_back(qualified, std::string(value));
+      } else if constexpr (F::kDuplicates == Duplicates::last) {
+        entries[position.first->second].second.assign(value.data(),
+                                                      value.size());
+      }
+    }
+  });
+  if (!ok) return false;
+  applyJournal(entries, positions, journal);
+  return true;
+}
+
+/**
+ * @brief decompresses the whole file, for edits which rewrite it anyway
+ *
+ * @return false if the file can not be read
+ */
+inline bool decompressFile(const char* path, Compression compression,
+                           std::string& content) {
+  DecompressingReader reader;
+  if (!reader.open(path, compression)) return false;
+  content.clear();
+  std::size_t used = 0;
+  ssize_t size;
+  do {
+    content.resize(used + DecompressingReader::kChunkSize);
+    size = reader.read(&content[used], DecompressingReader::kChunkSize);
+    if (size > 0) used += size;
+  } while (size > 0);
+  content.resize(used);
+  return size == 0;
+}
+
+/**
+ * @brief replaces the file by the compressed document, see replaceFile()
+ *
+ * @return false if the file can not be replaced, errno is set
+ */
+inline bool replaceFile(const char* path, const Document& document,
+                        Compression compression) {
+  if (compression == Compression::none) return replaceFile(path, document);
+  return replaceFileWith(path, [&](int fd) {
+    CompressingWriter writer;
+    bool ok = writer.open(fd, compression);
+    document.forEachPiece([&](std::string_view piece) {
+      ok = ok && writer.write(piece);
+    });
+    return ok && writer.finish();
+  });
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_COMPRESSED_HPP
@@ -0,0 +1,463 @@
+/**
+ * @file option_document.hpp
+ * @author Herwig Letofsky
+ * @brief piece table over the original content of an option file. Edits are
+ * recorded per line and reference the original buffer for everything they
+ * do not touch, so serializing a document is a sequence of writev() calls
+ * over unchanged spans and the edited lines, and the cost of an edit depends
+ * on the edit and not on the file size.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_DOCUMENT_HPP
+#define OPTION_DOCUMENT_HPP
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "option_file.hpp"
+
+namespace ofp {
+
+class Document {
+ public:
+  /**
+   * @param original content of the file, has to outlive the document
+   */
+  explicit Document(std::string_view original)
+      : original_(original), lines_(splitLines(original)) {}
+
+  /**
+   * @return the original lines, without newline
+   */
+  const std::vector<std::string_view>& lines() const { return lines_; }
+
+  std::string_view original() const { return original_; }
+
+  bool modified() const { return !edits_.empty(); }
+
+  /**
+   * @return false if the original content does not end with a newline
+   */
+  bool terminated() const {
+    return original_.empty() || original_.back() == '\n';
+  }
+
+  void replaceLine(std::size_t line, std::string_view text) {
+    Edit& edit = edits_[line];
+    edit.replacement = add(text);
+    edit.removed = false;
+  }
+
+  void removeLine(std::size_t line) {
+    Edit& edit = edits_[line];
+    edit.replacement.reset();
+    edit.removed = true;
+  }
+
+  /**
+   * @brief inserts a line in front of the given original line, or at the end
+   * for line == lines().size()
+   */
+  void insertLine(std::size_t line, std::string_view text) {
+    edits_[line].inserted.push_back(add(text));
+  }
+
+  /**
+   * @brief calls fn(piece) for the pieces making up the edited content
+   */
+  template <typename Fn>
+  void forEachPiece(Fn fn) const {
+    std::size_t next = 0;  // first original line which is not emitted yet
+    bool terminated = true;
+    auto emitOriginal = [&](std::size_t from, std::size_t to) {
+      if (from >= to) return;
+      const char* begin = lines_[from].data();
+      const char* end = to < lines_.size() ? lines_[to].data()
+                                           : original_.data() + original_.size();
+      fn(std::string_view(begin, end - begin));
+      terminated = end[-1] == '\n';
+    };
+    auto emitAdded = [&](const Span& span) {
+      if (!terminated) fn(std::string_view("\n"));
+      fn(std::string_view(added_).substr(span.offset, span.size));
+      terminated = true;
+    };
+
+    for (auto& entry : edits_) {
+      emitOriginal(next, entry.first);
+      next = entry.first;
+      for (auto& span : entry.second.inserted) emitAdded(span);
+      if (entry.first == lines_.size()) break;
+      if (entry.second.replacement) {
+        emitAdded(*entry.second.replacement);
+      } else if (!entry.second.removed) {
+        emitOriginal(entry.first, entry.first + 1);
+      }
+      next = entry.first + 1;
+    }
+    emitOriginal(next, lines_.size());
+  }
+
+  /**
+   * @brief calls fn(line, inserted, replacement, removed) for every original
+   * line with edits, in order. inserted holds the lines added in front of the
+   * line, line == lines().size() the lines added at the end. All lines are
+   * passed without newline.
+   */
+  template <typename Fn>
+  void forEachEdit(Fn fn) const {
+    std::vector<std::string_view> inserted;
+    for (auto& entry : edits_) {
+      inserted.clear();
+      for (auto& span : entry.second.inserted) inserted.push_back(text(span));
+      std::optional<std::string_view> replacement;
+      if (entry.second.replacement) {
+        replacement = text(*entry.second.replacement);
+      }
+      fn(entry.first, inserted, replacement, entry.second.removed);
+    }
+  }
+
+  /**
+   * @brief writes the edited content with as few writev() calls as possible
+   *
+   * @return false on write errors, errno is set
+   */
+  bool write(int fd) const {
+    std::vector<iovec> pieces;
+    forEachPiece([&pieces](std::string_view piece) {
+      pieces.push_back({const_cast<char*>(piece.data()), piece.size()});
+    });
+    std::size_t first = 0;
+    while (first < pieces.size()) {
+      int count = static_cast<int>(std::min<std::size_t>(
+          pieces.size() - first, IOV_MAX));
+      ssize_t written = ::writev(fd, &pieces[first], count);
+      if (written < 0) return false;
+      // skip what has been written, continue within a partial piece
+      while (first < pieces.size() &&
+             static_cast<std::size_t>(written) >= pieces[first].iov_len) {
+        written -= pieces[first].iov_len;
+        ++first;
+      }
+      if (first < pieces.size()) {
+        pieces[first].iov_base =
+            static_cast<char*>(pieces[first].iov_base) + written;
+        pieces[first].iov_len -= written;
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct Span {
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  struct Edit {
+    std::vector<Span> inserted;
+    std::optional<Span> replacement;
+    bool removed = false;
+  };
+
+  // added line without its newline
+  std::string_view text(const Span& span) const {
+    return std::string_view(added_).substr(span.offset, span.size - 1);
+  }
+
+  // appends the text and its newline to the add buffer
+  Span add(std::string_view text) {
+    Span span{added_.size(), text.size() + 1};
+    added_.append(text.data(), text.size());
+    added_ += '\n';
+    return span;
+  }
+
+  std::string_view original_;
+  std::vector<std::string_view> lines_;
+  std::string added_;
+  std::map<std::size_t, Edit> edits_;
+};
+
+/**
+ * @brief applies WRITE and DELETE to a document. A write replaces the value
+ * of the first line holding the key or adds the key to its section, a delete
+ * removes all lines holding the key. Writes of the value a key holds already
+ * leave the document unmodified.
+ *
+ * @param writes container of <key, value> pairs
+ * @param deletes container of keys
+ */
+template <typename Writes, typename Deletes>
+void editLines(Document& document, const Writes& writes,
+               const Deletes& deletes) {
+  const std::vector<std::string_view>& lines = document.lines();
+  SectionIndex index(lines);
+  // new sections, appended at the end of the file
+  std::map<std::string, std::vector<std::string>> new_sections;
+
+  // scanning the sections once per key is quadratic when compacting a long
+  // journal, if that scans more lines than the file has all keys get their
+  // lines from a single pass instead
+  std::unordered_map<std::string, std::vector<SectionIndex::Match>> batch;
+  std::size_t scanned = 0;
+  for (auto& key : deletes) scanned += index.scanSize(key);
+  for (auto& keyValuePair : writes) {
+    if (scanned > lines.size()) break;
+    scanned += index.scanSize(keyValuePair.first);
+  }
+  bool batched = scanned > lines.size();
+  if (batched) {
+    for (auto& key : deletes) batch[key];
+    for (auto& keyValuePair : writes) batch[keyValuePair.first];
+    std::string qualified;
+    forEachEntry(lines, [&](std::string_view section, std::string_view key,
+                            std::string_view, std::size_t i) {
+      qualified.assign(section.data(), section.size());
+      if (!section.empty()) qualified += '.';
+      qualified.append(key.data(), key.size());
+      auto it = batch.find(qualified);
+      if (it != batch.end()) it->second.push_back({i, lines[i].find('=')});
+    });
+  }
+  auto find = [&](const std::string& key) {
+    return batched ? batch[key] : index.find(key);
+  };
+
+  for (auto& key : deletes) {
+    for (auto& match : find(key)) {
+      document.removeLine(match.line);
+    }
+  }
+  // new keys of a sorted file which go to the same line have to be added
+  // in order
+  std::vector<decltype(&*writes.begin())> ordered;
+  for (auto& keyValuePair : writes) ordered.push_back(&keyValuePair);
+  if (index.sorted()) {
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [](auto a, auto b) { return a->first < b->first; });
+  }
+  for (auto write : ordered) {
+    auto& keyValuePair = *write;
+    auto matches = find(keyValuePair.first);
+    if (!matches.empty()) {
+      // replace value of existing key, keeping its name in the section
+      std::string_view line = lines[matches.front().line];
+      if (trim(line.substr(matches.front().eq_pos + 1)) ==
+          keyValuePair.second) {
+        continue;  // holds the value already, leave the line alone
+      }
+      document.replaceLine(matches.front().line,
+                           std::string(trim(line.substr(
+                               0, matches.front().eq_pos))) +
+                               "=" + keyValuePair.second);
+      continue;
+    }
+    // add new key-value pair
+    std::size_t line = 0;
+    std::string section;
+    std::string key = index.insertionPoint(keyValuePair.first, line, section);
+    if (section.empty()) {
+      document.insertLine(line, key + "=" + keyValuePair.second);
+    } else {
+      new_sections[section].emplace_back(key + "=" + keyValuePair.second);
+    }
+  }
+  for (auto& section : new_sections) {
+    document.insertLine(lines.size(), "[" + section.first + "]");
+    for (auto& line : section.second) document.insertLine(lines.size(), line);
+  }
+}
+
+namespace detail {
+
+// write() until all of the data is written
+inline bool writeAll(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t result = ::write(fd, data, size);
+    if (result < 0) return false;
+    data += result;
+    size -= result;
+  }
+  return true;
+}
+
+/**
+ * @brief opens and locks the file, retrying if it has been replaced by a
+ * rename while waiting for the lock. Every writer of a file takes this lock
+ * before it reads what it is going to write back.
+ *
+ * @param flags open() flags, O_RDONLY for a file that is replaced
+ * @return file descriptor or -1, errno is set
+ */
+inline int openLocked(const char* path, int flags = O_RDONLY) {
+  while (true) {
+    int fd = ::open(path, flags | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat locked, current;
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &locked) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    if (::stat(path, &current) == 0 && current.st_ino == locked.st_ino &&
+        current.st_dev == locked.st_dev) {
+      return fd;
+    }
+    ::close(fd);
+  }
+}
+
+}  // namespace detail
+
+/**
+ * @brief exclusive lock of a file, see detail::openLocked(). A writer holds
+ * it from reading the file until the file has been replaced.
+ */
+class FileLock {
+ public:
+  FileLock() = default;
+  FileLock(const FileLock&) = delete;
+  FileLock& operator=(const FileLock&) = delete;
+  ~FileLock() {
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  /**
+   * @return false if the file can not be opened, errno is set
+   */
+  bool lock(const char* path) {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = detail::openLocked(path);
+    return fd_ >= 0;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+namespace detail {
+
+// read once, umask() can only be read by setting it, which would race with
+// other threads creating files
+inline mode_t processUmask() {
+  static const mode_t mask = [] {
+    mode_t current = umask(0);
+    umask(current);
+    return current;
+  }();
+  return mask;
+}
+
+/**
+ * @brief rewrites the file in place with what write(fd) writes, for files
+ * which can not be replaced by a rename. The output goes to an unnamed
+ * temporary file first, as write(fd) may read from a mapping of the file.
+ *
+ * @return false if the file can not be written, errno is set
+ */
+template <typename Write>
+bool rewriteFileWith(const char* path, Write write) {
+  std::FILE* temp = std::tmpfile();
+  if (!temp) return false;
+  int temp_fd = fileno(temp);
+  int fd = -1;
+  bool ok = write(temp_fd) && ::lseek(temp_fd, 0, SEEK_SET) == 0 &&
+            (fd = ::open(path, O_WRONLY | O_CLOEXEC)) >= 0;
+  off_t size = 0;
+  char buffer[64 * 1024];
+  while (ok) {
+    ssize_t result = ::read(temp_fd, buffer, sizeof(buffer));
+    if (result <= 0) {
+      ok = result == 0;
+      break;
+    }
+    ok = writeAll(fd, buffer, result);
+    size += result;
+  }
+  // shrink the file only once the new content is in place
+  ok = ok && ftruncate(fd, size) == 0 && fsync(fd) == 0;
+  if (fd >= 0) ok = ::close(fd) == 0 && ok;
+  std::fclose(temp);
+  return ok;
+}
+
+}  // namespace detail
+
+/**
+ * @brief replaces the file by what write(fd) writes, through a temporary
+ * file in the same directory which is synced and renamed over it. A
+ * symbolic link is followed, a file with further hard links or in a
+ * directory we may not write to is rewritten in place instead. A new file
+ * gets 0666 less the umask.
+ *
+ * @param sync false if write(fd) syncs the file itself
+ * @return false if the file can not be replaced, errno is set
+ */
+template <typename Write>
+bool replaceFileWith(const char* path, Write write, bool sync = true) {
+  char resolved[PATH_MAX];
+  if (realpath(path, resolved)) path = resolved;
+  struct stat info;
+  bool exists = ::stat(path, &info) == 0;
+  if (exists) {
+    std::string_view name(path);
+    std::size_t slash = name.rfind('/');
+    std::string directory = slash == std::string_view::npos ? "."
+                            : slash == 0 ? "/"
+                                         : std::string(name.substr(0, slash));
+    if (info.st_nlink > 1 || ::access(directory.c_str(), W_OK) != 0) {
+      return detail::rewriteFileWith(path, write);
+    }
+  }
+
+  std::string temp_path = std::string(path) + ".XXXXXX";
+  int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) return false;
+  if (exists) {
+    fchmod(fd, info.st_mode & 07777);
+    if (fchown(fd, info.st_uid, info.st_gid) != 0) {
+      // keep the owner of the temporary file if we may not change it
+    }
+  } else {
+    // mkstemp() creates the file private, a new file gets the mode open()
+    // would give it
+    fchmod(fd, 0666 & ~detail::processUmask());
+  }
+  bool ok = write(fd) && (!sync || fsync(fd) == 0);
+  ok = ::close(fd) == 0 && ok;
+  ok = ok && ::rename(temp_path.c_str(), path) == 0;
+  if (!ok) ::unlink(temp_path.c_str());
+  return ok;
+}
+
+/**
+ * @brief replaces the file by the document, see replaceFileWith()
+ *
+ * @return false if the file can not be replaced, errno is set
+ */
+inline bool replaceFile(const char* path, const Document& document) {
+  return replaceFileWith(path,
+                         [&document](int fd) { return document.write(fd); });
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_DOCUMENT_HPP
@@ -0,0 +1,147 @@
+/**
+ * @file option_export.hpp
+ * @author Herwig Letofsky
+ * @brief hands options to shell scripts and other programs in one parse.
+ * Keys become variable names, "db.host" turns into DB_HOST, and values are
+ * single-quoted for the shell, which leaves no character special:
+ *
+ *   eval "$(option_file_parser -f app.conf --export 'db.*' log.level)"
+ *   option_file_parser -f app.conf --exec ./server --verbose
+ *
+ * Keys like "path" or "ld.preload" would take over variables which decide
+ * what a shell or the dynamic loader runs, reservedName() tells them apart.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_EXPORT_HPP
+#define OPTION_EXPORT_HPP
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "option_key_index.hpp"
+
+namespace ofp {
+
+/**
+ * @return the key as environment variable name: upper case, every other
+ * character but letters, digits and '_' replaced by '_', and a leading
+ * digit prefixed with '_'
+ */
+inline std::string shellName(std::string_view key) {
+  std::string name;
+  if (key.empty() || (key[0] >= '0' && key[0] <= '9')) name += '_';
+  for (char c : key) {
+    if (c >= 'a' && c <= 'z') {
+      name += static_cast<char>(c - 'a' + 'A');
+    } else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+      name += c;
+    } else {
+      name += '_';
+    }
+  }
+  return name;
+}
+
+/**
+ * @return true for variables which change how a command is found, loaded or
+ * interpreted by the shell, which options must not set
+ */
+inline bool reservedName(std::string_view name) {
+  constexpr std::string_view kNames[] = {
+      "PATH",      "IFS",        "ENV", "BASH_ENV",      "CDPATH",
+      "SHELLOPTS", "GLOBIGNORE", "PS4", "PROMPT_COMMAND"};
+  constexpr std::string_view kPrefixes[] = {"LD_", "DYLD_", "BASH_FUNC_"};
+  for (auto reserved : kNames) {
+    if (name == reserved) return true;
+  }
+  for (auto prefix : kPrefixes) {
+    if (name.substr(0, prefix.size()) == prefix) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief appends the value in single quotes, a quote inside the value
+ * closes them, is escaped and opens them again
+ */
+inline void appendShellQuoted(std::string& out, std::string_view value) {
+  out += '\'';
+  for (char c : value) {
+    if (c == '\'') {
+      out += "'\\''";
+    } else {
+      out += c;
+    }
+  }
+  out += '\'';
+}
+
+/**
+ * @brief the entries selected by keys and glob patterns, or all of them if
+ * there is no selector
+ *
+ * @param missing keys which are no pattern and have no entry
+ * @return positions of the selected entries, in file order
+ */
+template <typename Selectors>
+std::vector<std::size_t> selectEntries(const KeyIndex::Entries& entries,
+                                       const Selectors& selectors,
+                                       std::vector<std::string>& missing) {
+  std::vector<bool> selected(entries.size(), selectors.empty());
+  KeyIndex index(entries);
+  for (auto& selector : selectors) {
+    std::vector<std::size_t> matches = index.match(selector, false);
+    if (matches.empty() && !isPattern(selector)) missing.push_back(selector);
+    for (std::size_t match : matches) selected[match] = true;
+  }
+  std::vector<std::size_t> positions;
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    if (selected[i]) positions.push_back(i);
+  }
+  return positions;
+}
+
+/**
+ * @return "NAME='value'" lines for the selected entries, for eval
+ */
+inline std::string shellAssignments(const KeyIndex::Entries& entries,
+                                    const std::vector<std::size_t>& positions) {
+  std::string out;
+  for (std::size_t i : positions) {
+    out += shellName(entries[i].first);
+    out += '=';
+    appendShellQuoted(out, entries[i].second);
+    out += '\n';
+  }
+  return out;
+}
+
+/**
+ * @brief puts the selected entries into the environment and replaces the
+ * process by the command, searched in $PATH like a shell does
+ *
+ * @param argv command and its arguments, terminated by a nullptr
+ * @return only if the command can not be executed, errno is set
+ */
+inline void execWithEntries(const KeyIndex::Entries& entries,
+                            const std::vector<std::size_t>& positions,
+                            char* const argv[]) {
+  for (std::size_t i : positions) {
+    if (setenv(shellName(entries[i].first).c_str(),
+               entries[i].second.c_str(), 1) != 0) {
+      return;
+    }
+  }
+  execvp(argv[0], argv);
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_EXPORT_HPP
@@ -0,0 +1,431 @@
+/**
+ * @file option_external_sort.hpp
+ * @author Herwig Letofsky
+ * @brief normalization of option files larger than the memory, as external
+ * merge sort. The file is read line by line into a buffer of records, a
+ * full buffer is sorted and spilled to a temporary file by a second thread
+ * while the next buffer fills. The sorted runs are merged with a loser tree,
+ * which picks the next record out of k runs with log2(k) comparisons, and
+ * only the winning record of every key is written:
+ *
+ *   ofp::NormalizeStats stats;
+ *   ofp::normalizeFile("huge.conf", ofp::Compression::none, 256 << 20,
+ *                      &stats);
+ *
+ * Two buffers and the read buffers of the merge share the memory budget.
+ * Temporary files are created next to the file and unlinked right away, so
+ * they vanish even if the process dies.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_EXTERNAL_SORT_HPP
+#define OPTION_EXTERNAL_SORT_HPP
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_compressed.hpp"
+#include "option_document.hpp"
+#include "option_file.hpp"
+#include "option_hash.hpp"
+#include "option_journal.hpp"
+
+namespace ofp {
+
+struct NormalizeStats {
+  std::size_t input_bytes = 0;
+  std::size_t output_bytes = 0;
+  std::size_t records = 0;  // key-value lines and journal records
+  std::size_t keys = 0;     // keys written
+  std::size_t runs = 0;     // sorted runs spilled to temporary files
+  bool unchanged = false;   // the file was normalized already
+  double seconds = 0;
+
+  double throughput() const { return seconds > 0 ? input_bytes / seconds : 0; }
+};
+
+namespace detail {
+
+// journal records rank below all lines, the last record first, lines rank
+// in file order, so the first occurrence of a key wins like for READ
+constexpr std::uint64_t kLineRank = 1ULL << 62;
+
+// smallest budget, below it the runs get too short to be worth a file
+constexpr std::size_t kMinSortBudget = 1 << 20;
+
+struct SortRecord {
+  std::string key;
+  std::string value;
+  std::string comments;  // attached comment lines, each with its newline
+  std::uint64_t rank = 0;
+  bool deleted = false;
+
+  std::size_t memoryUsage() const {
+    return sizeof(SortRecord) + key.size() + value.size() + comments.size();
+  }
+};
+
+inline bool recordLess(const SortRecord& a, const SortRecord& b) {
+  int order = a.key.compare(b.key);
+  return order < 0 || (order == 0 && a.rank < b.rank);
+}
+
+// sorts the records and writes them to the run file
+inline bool spillRun(int fd, std::vector<SortRecord>& records) {
+  std::sort(records.begin(), records.end(), recordLess);
+  constexpr std::size_t kFlushSize = 1 << 20;
+  std::string out;
+  for (auto& record : records) {
+    std::uint32_t sizes[3] = {static_cast<std::uint32_t>(record.key.size()),
+                              static_cast<std::uint32_t>(record.value.size()),
+                              static_cast<std::uint32_t>(
+                                  record.comments.size())};
+    out.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    out.append(reinterpret_cast<const char*>(&record.rank),
+               sizeof(record.rank));
+    out += static_cast<char>(record.deleted);
+    out.append(record.key).append(record.value).append(record.comments);
+    if (out.size() >= kFlushSize) {
+      if (!writeAll(fd, out.data(), out.size())) return false;
+      out.clear();
+    }
+  }
+  return writeAll(fd, out.data(), out.size()) && lseek(fd, 0, SEEK_SET) == 0;
+}
+
+// sorted run, read back from its file or straight from memory
+class RunReader {
+ public:
+  RunReader(int fd, std::size_t buffer_size)
+      : fd_(fd), buffer_(buffer_size) {}
+  explicit RunReader(const std::vector<SortRecord>* records)
+      : records_(records) {}
+
+  /**
+   * @return false at the end of the run or on a read error
+   */
+  bool next() {
+    if (records_) {
+      if (index_ == records_->size()) return false;
+      current_ = &(*records_)[index_++];
+      return true;
+    }
+    constexpr std::size_t kHeaderSize = 3 * sizeof(std::uint32_t) + 9;
+    if (!fill(kHeaderSize)) return false;
+    std::uint32_t sizes[3];
+    std::memcpy(sizes, &buffer_[pos_], sizeof(sizes));
+    std::memcpy(&record_.rank, &buffer_[pos_ + sizeof(sizes)],
+                sizeof(record_.rank));
+    record_.deleted = buffer_[pos_ + kHeaderSize - 1] != 0;
+    std::size_t size = kHeaderSize + sizes[0] + sizes[1] + sizes[2];
+    if (!fill(size)) {
+      error_ = true;
+      return false;
+    }
+    const char* data = &buffer_[pos_ + kHeaderSize];
+    record_.key.assign(data, sizes[0]);
+    record_.value.assign(data + sizes[0], sizes[1]);
+    record_.comments.assign(data + sizes[0] + sizes[1], sizes[2]);
+    pos_ += size;
+    current_ = &record_;
+    return true;
+  }
+
+  const SortRecord& current() const { return *current_; }
+
+  bool error() const { return error_; }
+
+ private:
+  // makes size bytes available at pos_
+  bool fill(std::size_t size) {
+    if (end_ - pos_ >= size) return true;
+    std::memmove(buffer_.data(), &buffer_[pos_], end_ - pos_);
+    end_ -= pos_;
+    pos_ = 0;
+    if (buffer_.size() < size) buffer_.resize(size);
+    while (end_ < size) {
+      ssize_t result = ::read(fd_, &buffer_[end_], buffer_.size() - end_);
+      if (result <= 0) {
+        if (result < 0 || end_ > 0) error_ = true;
+        return false;
+      }
+      end_ += result;
+    }
+    return true;
+  }
+
+  int fd_ = -1;
+  std::vector<char> buffer_;
+  std::size_t pos_ = 0;
+  std::size_t end_ = 0;
+  SortRecord record_;
+  const std::vector<SortRecord>* records_ = nullptr;
+  std::size_t index_ = 0;
+  const SortRecord* current_ = nullptr;
+  bool error_ = false;
+};
+
+/**
+ * @brief k-way merge of sorted runs. The inner nodes hold the loser of the
+ * match below them, so replacing the winner replays only its path to the
+ * root.
+ */
+class LoserTree {
+ public:
+  explicit LoserTree(std::vector<RunReader>& runs)
+      : runs_(runs), done_(runs.size()), tree_(runs.size()) {
+    std::size_t k = runs_.size();
+    for (std::size_t i = 0; i < k; ++i) done_[i] = !runs_[i].next();
+    std::vector<std::size_t> winners(2 * k);
+    for (std::size_t i = 0; i < k; ++i) winners[k + i] = i;
+    for (std::size_t i = k - 1; i >= 1; --i) {
+      std::size_t a = winners[2 * i], b = winners[2 * i + 1];
+      bool a_wins = less(a, b);
+      winners[i] = a_wins ? a : b;
+      tree_[i] = a_wins ? b : a;
+    }
+    tree_[0] = k == 1 ? 0 : winners[1];
+  }
+
+  bool empty() const { return done_[tree_[0]]; }
+
+  const SortRecord& top() const { return runs_[tree_[0]].current(); }
+
+  void pop() {
+    std::size_t winner = tree_[0];
+    done_[winner] = !runs_[winner].next();
+    for (std::size_t node = (winner + runs_.size()) / 2; node > 0; node /= 2) {
+      if (less(tree_[node], winner)) std::swap(tree_[node], winner);
+    }
+    tree_[0] = winner;
+  }
+
+ private:
+  bool less(std::size_t a, std::size_t b) const {
+    if (done_[a]) return false;
+    if (done_[b]) return true;
+    return recordLess(runs_[a].current(), runs_[b].current());
+  }
+
+  std::vector<RunReader>& runs_;
+  std::vector<char> done_;
+  std::vector<std::size_t> tree_;  // tree_[0] is the winner
+};
+
+// calls fn(line) for every line of the file, without the newline
+template <typename Fn>
+bool forEachFileLine(const char* path, Compression compression,
+                     std::size_t& bytes, Fn fn) {
+  bytes = 0;
+  auto counted = [&](std::string_view line) {
+    bytes += line.size() + 1;
+    fn(line);
+  };
+  if (compression != Compression::none) {
+    DecompressingReader reader;
+    return reader.open(path, compression) && reader.forEachLine(counted);
+  }
+  MappedFile file;
+  if (!file.open(path)) return false;
+  forEachLine(file.view(), counted);
+  bytes = file.view().size();
+  return true;
+}
+
+}  // namespace detail
+
+/**
+ * @brief rewrites the file as sorted file, see option_sorted.hpp. Duplicate
+ * keys are resolved like READ does: journal records win over lines, the
+ * last record first, and the first line of a key wins over later ones. A
+ * block of comment lines directly in front of a key moves with the key,
+ * other comments stay at the top of the file, followed by a blank line.
+ * Other blank lines and section headers are dropped.
+ *
+ * @param budget bytes of memory for records and buffers
+ * @return false if the file can not be read or replaced
+ */
+inline bool normalizeFile(const char* path, Compression compression,
+                          std::size_t budget, NormalizeStats* stats = nullptr) {
+  using detail::SortRecord;
+  auto start = std::chrono::steady_clock::now();
+  NormalizeStats local;
+  NormalizeStats& result = stats ? *stats : local;
+  result = NormalizeStats();
+  budget = std::max(budget, detail::kMinSortBudget);
+  FileLock lock;  // held until the file is replaced
+  if (!lock.lock(path)) return false;
+
+  // two buffers: one fills while the other one is sorted and spilled
+  std::vector<SortRecord> buffer, spilled;
+  std::size_t used = 0;
+  std::vector<int> run_fds;
+  std::future<bool> spilling;
+  bool ok = true;
+  auto closeRuns = [&run_fds]() {
+    for (int fd : run_fds) ::close(fd);
+  };
+  auto spill = [&]() {
+    if (spilling.valid()) ok = spilling.get() && ok;
+    std::string temp_path = std::string(path) + ".run.XXXXXX";
+    int fd = mkstemp(&temp_path[0]);
+    if (fd < 0) {
+      ok = false;
+      return;
+    }
+    ::unlink(temp_path.c_str());
+    run_fds.push_back(fd);
+    spilled.swap(buffer);
+    buffer.clear();
+    used = 0;
+    spilling = std::async(std::launch::async, [&spilled, fd]() {
+      return detail::spillRun(fd, spilled);
+    });
+  };
+
+  std::string preamble;  // comments which belong to no key
+  std::vector<std::string> comments;
+  std::string section;
+  std::uint64_t rank = detail::kLineRank;
+  ContentHash input_hash;
+  bool first = true;
+  std::string_view name, key, value;
+  auto flushComments = [&]() {
+    for (auto& comment : comments) preamble.append(comment) += '\n';
+    comments.clear();
+  };
+  bool read = detail::forEachFileLine(
+      path, compression, result.input_bytes, [&](std::string_view line) {
+        input_hash.update(line);
+        input_hash.update("\n");
+        if (first && line == kSortedMarker) {
+          first = false;
+          return;
+        }
+        first = false;
+        if (!line.empty() && line[0] == '#') {
+          comments.emplace_back(line);
+          return;
+        }
+        if (lineIsSection(line, name)) {
+          section.assign(name.data(), name.size());
+        } else if (splitLine(line, key, value)) {
+          SortRecord record{qualifiedKey(section, key), std::string(value),
+                            std::string(), rank++, false};
+          for (auto& comment : comments) {
+            record.comments.append(comment) += '\n';
+          }
+          comments.clear();
+          ++result.records;
+          used += record.memoryUsage();
+          buffer.push_back(std::move(record));
+          if (2 * used > budget) spill();
+          return;
+        }
+        flushComments();
+      });
+  if (spilling.valid()) ok = spilling.get() && ok;
+  if (!read || !ok) {
+    closeRuns();
+    return false;
+  }
+
+  // the records at the very end are the journal, the last one ranks first
+  std::size_t journal_begin = comments.size();
+  while (journal_begin > 0 &&
+         lineIsJournalRecord(comments[journal_begin - 1])) {
+    --journal_begin;
+  }
+  bool removed = false;
+  for (std::size_t i = journal_begin; i < comments.size(); ++i) {
+    if (!parseJournalRecord(comments[i], key, value, removed)) continue;
+    buffer.push_back({std::string(key), std::string(value), std::string(),
+                      comments.size() - 1 - i, removed});
+    ++result.records;
+  }
+  comments.resize(journal_begin);
+  flushComments();
+  std::sort(buffer.begin(), buffer.end(), detail::recordLess);
+  result.runs = run_fds.size();
+
+  // merge, the read buffers share the half of the budget the last buffer
+  // does not hold
+  std::vector<detail::RunReader> runs;
+  std::size_t buffer_size = std::max<std::size_t>(
+      64 * 1024, budget / 2 / std::max<std::size_t>(run_fds.size(), 1));
+  for (int fd : run_fds) runs.emplace_back(fd, buffer_size);
+  runs.emplace_back(&buffer);
+
+  ContentHash output_hash;
+  bool merged = replaceFileWith(path, [&](int fd) {
+    CompressingWriter writer;
+    if (compression != Compression::none && !writer.open(fd, compression)) {
+      return false;
+    }
+    constexpr std::size_t kFlushSize = 1 << 20;
+    std::string out(kSortedMarker);
+    out += '\n';
+    out += preamble;
+    if (!preamble.empty()) out += '\n';
+    bool written = true;
+    auto flush = [&]() {
+      output_hash.update(out);
+      result.output_bytes += out.size();
+      written = written && (compression == Compression::none
+                                ? detail::writeAll(fd, out.data(), out.size())
+                                : writer.write(out));
+      out.clear();
+    };
+
+    detail::LoserTree tree(runs);
+    while (!tree.empty() && written) {
+      // the first record of a key wins, the comments come from its first
+      // line, which may follow journal records
+      SortRecord winner = tree.top();
+      bool has_line = winner.rank >= detail::kLineRank;
+      tree.pop();
+      while (!tree.empty() && tree.top().key == winner.key) {
+        if (!has_line && tree.top().rank >= detail::kLineRank) {
+          winner.comments = tree.top().comments;
+          has_line = true;
+        }
+        tree.pop();
+      }
+      if (winner.deleted) continue;
+      out.append(winner.comments).append(winner.key).append("=");
+      // "key=" is no key-value line, "key= " reads as the empty value
+      out.append(winner.value.empty() ? " " : winner.value) += '\n';
+      ++result.keys;
+      if (out.size() >= kFlushSize) flush();
+    }
+    flush();
+    for (auto& run : runs) written = written && !run.error();
+    if (written && output_hash.digest() == input_hash.digest() &&
+        result.output_bytes == result.input_bytes) {
+      result.unchanged = true;
+      return false;  // leaves the file alone
+    }
+    return written &&
+           (compression == Compression::none || writer.finish());
+  });
+  closeRuns();
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  result.seconds = time.count();
+  return merged || result.unchanged;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_EXTERNAL_SORT_HPP
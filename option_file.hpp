@@ -0,0 +1,455 @@
+/**
+ * @file option_file.hpp
+ * @author Herwig Letofsky
+ * @brief line parsing rules of the option file format, shared by the command
+ * line tool and library users. Header only, requires C++17.
+ *
+ * The rules of a key-value line are a policy, each function parsing them is
+ * a template specialized for it, so the choices are made at compile time
+ * and not per line. "<key>=<value>" is the default, other formats read the
+ * same way:
+ *
+ *   using IniColon = ofp::Format<':', ';'>;  // "key: value", ';' comments
+ *   auto entries = ofp::readEntries<IniColon>(ofp::splitLines(buffer));
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_FILE_HPP
+#define OPTION_FILE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ofp {
+
+constexpr std::string_view kWhitespace = " \t\n\v\f\r";
+
+// first line of a file whose keys are sorted, see option_sorted.hpp
+constexpr std::string_view kSortedMarker = "#@sorted";
+
+enum class Trim : uint8_t { none = 0x00, both };
+enum class Duplicates : uint8_t { first = 0x00, last };
+enum class LineEnding : uint8_t { lf = 0x00, crlf };
+
+/**
+ * @brief format of a key-value line
+ *
+ * @tparam Separator between key and value, the first one on the line counts
+ * @tparam Comment lines starting with it are no key-value lines
+ * @tparam trim_mode whitespace around key and value is dropped or kept
+ * @tparam duplicates which occurrence of a repeated key wins
+ * @tparam line_ending crlf drops the carriage return of every line
+ */
+template <char Separator, char Comment = '#', Trim trim_mode = Trim::both,
+          Duplicates duplicates = Duplicates::first,
+          LineEnding line_ending = LineEnding::lf>
+struct Format {
+  static constexpr char kSeparator = Separator;
+  static constexpr char kComment = Comment;
+  static constexpr Trim kTrim = trim_mode;
+  static constexpr Duplicates kDuplicates = duplicates;
+  static constexpr LineEnding kLineEnding = line_ending;
+};
+
+using EqualsFormat = Format<'='>;  // "key=value"
+using ColonFormat = Format<':'>;   // "key: value"
+using SpaceFormat = Format<' '>;   // "key value"
+
+// the prebuilt formats, for choosing one at run time
+enum class FileFormat : uint8_t { equals = 0x00, colon, space };
+
+/**
+ * @return false if name is neither "equals", "colon" nor "space"
+ */
+inline bool parseFileFormat(std::string_view name, FileFormat& format) {
+  if (name == "equals") {
+    format = FileFormat::equals;
+  } else if (name == "colon") {
+    format = FileFormat::colon;
+  } else if (name == "space") {
+    format = FileFormat::space;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline std::string_view ltrim(std::string_view s) {
+  std::size_t first = s.find_first_not_of(kWhitespace);
+  return first == std::string_view::npos ? std::string_view() : s.substr(first);
+}
+
+inline std::string_view rtrim(std::string_view s) {
+  std::size_t last = s.find_last_not_of(kWhitespace);
+  return last == std::string_view::npos ? std::string_view()
+                                        : s.substr(0, last + 1);
+}
+
+inline std::string_view trim(std::string_view s) { return ltrim(rtrim(s)); }
+
+inline std::string ltrim(const std::string& s) {
+  return std::string(ltrim(std::string_view(s)));
+}
+
+inline std::string rtrim(const std::string& s) {
+  return std::string(rtrim(std::string_view(s)));
+}
+
+inline std::string trim(const std::string& s) {
+  return std::string(trim(std::string_view(s)));
+}
+
+/**
+ * @brief FNV-1a hash of a key, usable at compile time. The hash can be
+ * continued with a further part, so "<section>.<key>" hashes the same no
+ * matter if it is hashed in one go or piece by piece.
+ */
+constexpr std::uint64_t hashKey(std::string_view key,
+                                std::uint64_t hash = 0xcbf29ce484222325ULL) {
+  for (char c : key) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * @brief checks if the line holds <key>, ignoring whitespace around the key
+ *
+ * @return position of the equal sign or std::string::npos
+ */
+inline std::size_t lineHasKey(std::string_view line, std::string_view key) {
+  std::size_t eq_pos = line.find('=');
+  if (eq_pos != std::string_view::npos && eq_pos > 0 &&
+      eq_pos < line.size() - 1) {
+    if (trim(line.substr(0, eq_pos)) == key) {
+      return eq_pos;
+    }
+  }
+  return std::string::npos;
+}
+
+/**
+ * @brief splits a "<key>=<value>" line, or one of another format, into its
+ * key and value
+ *
+ * @return false for lines without a key-value pair and commented lines
+ */
+template <typename F = EqualsFormat>
+bool splitLine(std::string_view line, std::string_view& key,
+               std::string_view& value) {
+  if constexpr (F::kLineEnding == LineEnding::crlf) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+  }
+  if (line.empty() || line[0] == F::kComment) return false;
+  std::size_t eq_pos = line.find(F::kSeparator);
+  if (eq_pos == std::string_view::npos || eq_pos == 0 ||
+      eq_pos == line.size() - 1) {
+    return false;
+  }
+  key = line.substr(0, eq_pos);
+  value = line.substr(eq_pos + 1);
+  if constexpr (F::kTrim == Trim::both) {
+    key = trim(key);
+    value = trim(value);
+  }
+  return true;
+}
+
+/**
+ * @brief checks if qualified equals "<section>.<key>", or just key in the
+ * global section, without concatenating the parts
+ */
+constexpr bool isQualifiedKey(std::string_view qualified,
+                              std::string_view section, std::string_view key) {
+  if (section.empty()) return qualified == key;
+  return qualified.size() == section.size() + 1 + key.size() &&
+         qualified.substr(0, section.size()) == section &&
+         qualified[section.size()] == '.' &&
+         qualified.substr(section.size() + 1) == key;
+}
+
+/**
+ * @brief checks if the line is a section header "[<name>]"
+ *
+ * @return true and the trimmed section name in name, false otherwise
+ */
+inline bool lineIsSection(std::string_view line, std::string_view& name) {
+  std::size_t first = line.find_first_not_of(" \t\r");
+  std::size_t last = line.find_last_not_of(" \t\r");
+  if (first == std::string_view::npos || line[first] != '[' ||
+      line[last] != ']' || first == last) {
+    return false;
+  }
+  name = trim(line.substr(first + 1, last - first - 1));
+  return true;
+}
+
+/**
+ * @brief calls fn(line) for every line of the buffer, without the newline
+ */
+template <typename Fn>
+void forEachLine(std::string_view buffer, Fn fn) {
+  const char* pos = buffer.data();
+  const char* end = pos + buffer.size();
+  while (pos < end) {
+    auto newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    const char* line_end = newline ? newline : end;
+    fn(std::string_view(pos, line_end - pos));
+    pos = line_end + 1;
+  }
+}
+
+/**
+ * @return views on the lines of the buffer, without newline
+ */
+inline std::vector<std::string_view> splitLines(std::string_view buffer) {
+  std::vector<std::string_view> lines;
+  forEachLine(buffer, [&lines](std::string_view line) {
+    lines.push_back(line);
+  });
+  return lines;
+}
+
+/**
+ * @brief calls fn(section, key, value, line_number) for every key-value line,
+ * in file order
+ */
+template <typename F = EqualsFormat, typename Fn>
+void forEachEntry(const std::vector<std::string_view>& lines, Fn fn) {
+  std::string_view section, key, value;
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    if (lineIsSection(lines[i], section)) continue;
+    if (splitLine<F>(lines[i], key, value)) fn(section, key, value, i);
+  }
+}
+
+/**
+ * @return "<section>.<key>", or key in the global section
+ */
+inline std::string qualifiedKey(std::string_view section, std::string_view key) {
+  std::string qualified;
+  qualified.reserve(section.size() + 1 + key.size());
+  if (!section.empty()) {
+    qualified.append(section.data(), section.size());
+    qualified += '.';
+  }
+  qualified.append(key.data(), key.size());
+  return qualified;
+}
+
+/**
+ * @brief read-only memory mapping of a whole file
+ */
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() { close(); }
+
+  /**
+   * @return false if the file can not be opened or mapped, errno is set
+   */
+  bool open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    if (ok && info.st_size > 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ok = data != MAP_FAILED;
+      if (ok) {
+        madvise(data, info.st_size, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data);
+        size_ = info.st_size;
+      }
+    }
+    ::close(fd);
+    return ok;
+  }
+
+  void close() {
+    if (data_) munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  std::string_view view() const { return std::string_view(data_, size_); }
+
+ private:
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+/**
+ * @brief Two-level index over the lines of an option file. The first level
+ * maps a section name to the line ranges it covers, the second level is the
+ * scan over those lines only. Lines before the first section header belong
+ * to the global section "". New keys of a file starting with kSortedMarker
+ * go to their sorted position, unless the file has section headers, which
+ * no sorted file has.
+ */
+class SectionIndex {
+ public:
+  using LineRange = std::pair<std::size_t, std::size_t>;  // [first, last)
+
+  struct Match {
+    std::size_t line;
+    std::size_t eq_pos;
+  };
+
+  explicit SectionIndex(const std::vector<std::string_view>& lines)
+      : lines_(lines),
+        sorted_(!lines.empty() && lines.front() == kSortedMarker) {
+    std::string_view name;
+    std::size_t begin = 0;
+    auto current = sections_.emplace("", std::vector<LineRange>()).first;
+    for (std::size_t i = 0; i < lines_.size(); ++i) {
+      if (!lineIsSection(lines_[i], name)) continue;
+      current->second.emplace_back(begin, i);
+      current = sections_.emplace(std::string(name), std::vector<LineRange>())
+                    .first;
+      begin = i + 1;
+    }
+    current->second.emplace_back(begin, lines_.size());
+    sorted_ = sorted_ && !hasSections();
+  }
+
+  bool hasSections() const { return sections_.size() > 1; }
+
+  bool sorted() const { return sorted_; }
+
+  /**
+   * @brief finds all lines holding the section-qualified key, in file order.
+   * "a.b.c" matches "a.b.c" in the global section, "b.c" in section [a] and
+   * "c" in section [a.b].
+   */
+  std::vector<Match> find(const std::string& key) const {
+    std::vector<Match> matches;
+    scan("", key, matches);
+    for (std::size_t dot = key.find('.'); dot != std::string::npos;
+         dot = key.find('.', dot + 1)) {
+      scan(key.substr(0, dot), key.substr(dot + 1), matches);
+    }
+    std::sort(matches.begin(), matches.end(),
+              [](const Match& a, const Match& b) { return a.line < b.line; });
+    return matches;
+  }
+
+  /**
+   * @return number of lines find() scans for the key
+   */
+  std::size_t scanSize(const std::string& key) const {
+    std::size_t size = sectionSize("");
+    for (std::size_t dot = key.find('.'); dot != std::string::npos;
+         dot = key.find('.', dot + 1)) {
+      size += sectionSize(key.substr(0, dot));
+    }
+    return size;
+  }
+
+  /**
+   * @brief determines where a new section-qualified key has to be inserted.
+   * The most specific existing section wins; otherwise a new section is
+   * created for dotted keys in files which already use sections, and the key
+   * goes to the global section in all other cases.
+   *
+   * @param line line number the key has to be inserted before
+   * @param section name of the section to create, empty if it exists
+   * @return the key as it has to be written within its section
+   */
+  std::string insertionPoint(const std::string& key, std::size_t& line,
+                             std::string& section) const {
+    section.clear();
+    for (std::size_t dot = key.rfind('.'); dot != std::string::npos && dot > 0;
+         dot = key.rfind('.', dot - 1)) {
+      auto it = sections_.find(key.substr(0, dot));
+      if (it != sections_.end() && !it->first.empty()) {
+        line = endOf(it->second.back());
+        return key.substr(dot + 1);
+      }
+    }
+    std::size_t dot = key.rfind('.');
+    if (hasSections() && dot != std::string::npos && dot > 0) {
+      section = key.substr(0, dot);
+      line = lines_.size();
+      return key.substr(dot + 1);
+    }
+    line = sorted_ ? sortedPosition(key) : endOf(sections_.at("").front());
+    return key;
+  }
+
+ private:
+  void scan(const std::string& section, const std::string& key,
+            std::vector<Match>& matches) const {
+    auto it = sections_.find(section);
+    if (it == sections_.end()) return;
+    for (auto& range : it->second) {
+      for (std::size_t i = range.first; i < range.second; ++i) {
+        if (!lines_[i].empty() && lines_[i][0] == '#') {
+          continue;  // ignore commented lines
+        }
+        std::size_t eq_pos = lineHasKey(lines_[i], key);
+        if (eq_pos != std::string::npos) matches.push_back({i, eq_pos});
+      }
+    }
+  }
+
+  std::size_t sectionSize(const std::string& section) const {
+    auto it = sections_.find(section);
+    if (it == sections_.end()) return 0;
+    std::size_t size = 0;
+    for (auto& range : it->second) size += range.second - range.first;
+    return size;
+  }
+
+  // in front of the first greater key and the comments attached to it
+  std::size_t sortedPosition(const std::string& key) const {
+    std::size_t block = 1;  // first line of the current comment block
+    std::string_view name, value;
+    for (std::size_t i = 1; i < lines_.size(); ++i) {
+      if (splitLine(lines_[i], name, value)) {
+        if (name > key) return block;
+        block = i + 1;
+      } else if (lines_[i].empty() || lines_[i][0] != '#') {
+        block = i + 1;
+      }
+    }
+    return block;
+  }
+
+  // keep blank lines in front of the following section header
+  std::size_t endOf(const LineRange& range) const {
+    std::size_t end = range.second;
+    if (end == lines_.size()) return end;
+    while (end > range.first &&
+           lines_[end - 1].find_first_not_of(" \t\r") ==
+               std::string_view::npos) {
+      --end;
+    }
+    return end;
+  }
+
+  const std::vector<std::string_view>& lines_;
+  bool sorted_;
+  std::map<std::string, std::vector<LineRange>> sections_;
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_FILE_HPP
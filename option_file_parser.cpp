@@ -7,6 +7,23 @@
  *  - One Key-Value pair per line
  *  - Key and Value are seperated by an equal sign with no spaces
  *    e.g: "<key>=<value>"
+ *  - Optional "[section]" lines group the following keys, which are then
+ *    addressed as "<section>.<key>"
+ *
+ * The line parsing rules live in option_file.hpp, typed access for library
+ * users in option_schema.hpp and option_perfect_hash.hpp, lookups in a
+ * published shared memory table in option_shared_table.hpp, the value search
+ * in option_search.hpp, compressed files in option_compressed.hpp, the
+ * io_uring engine in option_io.hpp, changesets in option_changeset.hpp,
+ * the content hash in option_hash.hpp, sorted files in option_sorted.hpp
+ * and their external sort in option_external_sort.hpp, the header generator
+ * in option_codegen.hpp, template rendering in option_render.hpp, shell
+ * export in option_export.hpp, response files in option_key_list.hpp,
+ * streaming in option_stream.hpp.
+ * Build with:
+ *   g++ -std=c++17 -O2 option_file_parser.cpp -o option_file_parser -lz \\
+ *       -pthread
+ * adding -lzstd if zstd.h is installed.
  *
  * @version 0.1
  * @date 2020-02-17
@@ -15,45 +32,592 @@
  *
  */
 
+#include <fnmatch.h>
 #include <getopt.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
-#include <list>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
-#include <regex>
+
+#include "option_changeset.hpp"
+#include "option_codegen.hpp"
+#include "option_compressed.hpp"
+#include "option_document.hpp"
+#include "option_export.hpp"
+#include "option_external_sort.hpp"
+#include "option_file.hpp"
+#include "option_io.hpp"
+#include "option_journal.hpp"
+#include "option_key_index.hpp"
+#include "option_key_list.hpp"
+#include "option_render.hpp"
+#include "option_search.hpp"
+#include "option_shared_table.hpp"
+#include "option_sorted.hpp"
+#include "option_stream.hpp"
+#include "option_transaction.hpp"
+
+using ofp::SectionIndex;
+using ofp::trim;
 
 #define APP_NAME "[OptionFileParser] "
 
-enum class ModifyKeysMode : uint8_t { read = 0x00, write, remove, undefined };
+// READ looks up up to this many keys one by one, more in one pass
+constexpr std::size_t kLookupKeyLimit = 64;
+
+// long options without a short equivalent
+enum LongOption : int {
+  kOptionSorted = 256,
+  kOptionSearch,
+  kOptionIo,
+  kOptionDiff,
+  kOptionApply,
+  kOptionHash,
+  kOptionNormalize,
+  kOptionMemoryBudget,
+  kOptionCodegen,
+  kOptionFormat,
+  kOptionRender,
+  kOptionExport,
+  kOptionKeysFrom
+};
+
+enum class ModifyKeysMode : uint8_t {
+  read = 0x00,
+  write,
+  remove,
+  compact,
+  transaction,
+  publish,
+  search,
+  apply,
+  hash,
+  normalize,
+  codegen,
+  render,
+  exportShell,
+  exec,
+  exists,
+  undefined
+};
 
 void print_help() {
-  std::cerr << "usage: command [-h] [-v] -f <file_to_parse> "
-               "[-s <key>=<value>... | -r <key>... | -d <key>...]\n"
+  std::cerr << "usage: command [-h] [-v] [-S] -f <file_to_parse> "
+               "[-s <key>=<value>... | -r <key>... | -d <key>... | "
+               "-e <key>... | -c | -t <operation>... | -P <name>]\n"
+            << "       command [-h] [-S] -f <file> | - [-o <file> | -] "
+               "[-w <key>=<value>... | -r <key>... | -d <key>...]\n"
+            << "       command [-h] [-v] -m <name> -r <key>... | -e <key>...\n"
+            << "       command [-h] [-S] --search <text> [-f <file>] "
+               "<file>...\n"
+            << "       command [-h] [-S] -f <file> --apply <changeset>\n"
+            << "       command [-h] [-S] -f <file> --hash | --normalize "
+               "[--memory-budget <size>]\n"
+            << "       command [-h] -f <file> --codegen <namespace>\n"
+            << "       command [-h] [-S] -f <file> --render <template>...\n"
+            << "       command [-h] -f <file> [<key>...] --export | --exec "
+               "<command>...\n"
             << "options:\n"
             << "  -h                   print usage information and exit\n"
             << "  -v                   show more detailed output\n"
+            << "  -S                   print statistics\n"
             << "  -f file_to_parse     path to file which should be parsed\n"
             << "                       file format has to be <key>=<value>\n"
+            << "                       keys below a [section] line are "
+               "addressed as <section>.<key>\n"
+            << "                       files ending in .gz or .zst are "
+               "decompressed while\n"
+            << "                       they are read and written back "
+               "compressed\n"
+            << "                       '-' reads the file from stdin and "
+               "writes it to stdout\n"
+            << "  -o, --output <file>  write the file with WRITE or DELETE "
+               "applied, or the\n"
+            << "                       values of READ, to <file> instead, "
+               "'-' for stdout\n"
+            << "                       -f - and -o stream the file with "
+               "bounded memory, new\n"
+            << "                       keys which belong in front of its "
+               "end are appended\n"
+            << "                       to the journal\n"
+            << "  --format <format>    line format for READ, PUBLISH, CODEGEN "
+               "and RENDER,\n"
+            << "                       'equals' (default) for <key>=<value>, "
+               "'colon' for\n"
+            << "                       <key>: <value> or 'space' for <key> "
+               "<value>\n"
             << "  -w <key>=<value>     set <key> to <value>\n"
-            << "  -r <key>             read value of <key>\n"
-            << "  -d <key>             delete key-value pair\n";
+            << "  -r <key>             read value of <key>, a glob pattern "
+               "like 'db.*'\n"
+            << "                       prints <key>=<value> for every "
+               "matching key\n"
+            << "  @<file>              read further arguments from the file, "
+               "one per line,\n"
+            << "                       blank lines and lines starting with "
+               "'#' are skipped,\n"
+            << "                       keys given more than once are used "
+               "once\n"
+            << "  --keys-from <file>   the same, '-' reads the arguments from "
+               "stdin\n"
+            << "  --sorted             print pattern matches in key order "
+               "instead of\n"
+            << "                       file order\n"
+            << "  -d <key>             delete key-value pair\n"
+            << "  -e <key>             check if the keys exist, exit code 0 "
+               "if all of them do,\n"
+            << "                       1 if some, 2 if none and 255 if the "
+               "file can not be\n"
+            << "                       read, -v lists the missing keys, the "
+               "file is scanned\n"
+            << "                       until all keys are found\n"
+            << "  -j                   append WRITE and DELETE to the journal "
+               "at the end\n"
+            << "                       of the file instead of rewriting it\n"
+            << "  -l <records>         compact the journal once it is longer "
+               "than <records>\n"
+            << "                       (default 1024, 0 never compacts)\n"
+            << "  -c                   compact the journal into the file\n"
+            << "  --diff               print the changes of WRITE, DELETE and "
+               "COMPACT as\n"
+            << "                       changeset instead of rewriting the "
+               "file\n"
+            << "  --apply <changeset>  apply a changeset made with --diff, "
+               "'-' reads it from\n"
+            << "                       stdin, exit code 1 if the file is not "
+               "the one it was\n"
+            << "                       made for, the new file version is "
+               "printed\n"
+            << "  --hash               print the file version, the same "
+               "XXH64 content hash\n"
+            << "                       TRANSACTION and --apply use, to "
+               "skip updates if the\n"
+            << "                       file did not change\n"
+            << "  --normalize          rewrite the file with its keys sorted, "
+               "duplicates and\n"
+            << "                       the journal resolved like READ does "
+               "and comments kept\n"
+            << "                       with their keys, READ binary-searches "
+               "such files\n"
+            << "  --memory-budget <size>\n"
+            << "                       memory NORMALIZE sorts in, larger "
+               "files are sorted in\n"
+            << "                       runs on disk and merged, suffixes K, M "
+               "and G (default\n"
+            << "                       64M)\n"
+            << "  --codegen <namespace>\n"
+            << "                       print a C++ header with the options "
+               "as constexpr tables\n"
+            << "                       behind a perfect hash and a typed "
+               "accessor per key,\n"
+            << "                       for options fixed at build time\n"
+            << "  --render             replace every {{<key>}} in the "
+               "templates given as\n"
+            << "                       arguments by its value, <name>.tmpl "
+               "is written to\n"
+            << "                       <name>, other templates to stdout, "
+               "exit code 1 and\n"
+            << "                       nothing written for templates with "
+               "missing keys\n"
+            << "  --export             print NAME='value' shell assignments "
+               "for eval, for the\n"
+            << "                       keys and glob patterns given as "
+               "arguments or all keys,\n"
+            << "                       db.host becomes DB_HOST, exit code 1 "
+               "if a key is missing\n"
+            << "                       or would set a variable like PATH or "
+               "LD_PRELOAD which\n"
+            << "                       changes how commands run, 127 if the "
+               "file can not be\n"
+            << "                       read\n"
+            << "  --exec <command>...  put the same variables into the "
+               "environment and execute\n"
+            << "                       the command, all arguments after "
+               "--exec belong to it\n"
+            << "  -t <operation>       apply all operations atomically, or "
+               "none of them if\n"
+            << "                       a precondition fails (exit code 1), "
+               "operations are\n"
+            << "                       'set <key>=<value>', 'del <key>',\n"
+            << "                       'expect <key>=<value>', 'absent <key>' "
+               "and\n"
+            << "                       'version <version>', the file version "
+               "is printed\n"
+            << "  -P, --publish <name> publish the options to the shared "
+               "memory segment\n"
+            << "                       <name>, readers are not blocked while "
+               "it is updated\n"
+            << "  -m, --shm <name>     READ or EXISTS from the shared memory "
+               "segment <name>\n"
+            << "                       instead of parsing a file\n"
+            << "  --search <text>      print <key>=<value> for every value "
+               "containing <text>,\n"
+            << "                       or matching it as a whole if it is a "
+               "glob pattern,\n"
+            << "                       in all files given with -f and as "
+               "arguments, exit\n"
+            << "                       code 1 if nothing matches\n"
+            << "  --io <engine>        'blocking' (default) or 'uring', "
+               "which keeps many\n"
+            << "                       reads in flight and reports SEARCH "
+               "results in the\n"
+            << "                       order the files complete, and links "
+               "the writes of the\n"
+            << "                       file with its fsync\n";
+}
+
+/**
+ * @brief prints the values of the keys in command line order, an empty line
+ * for a missing key and <key>=<value> for every entry matching a pattern
+ *
+ * @param entries key-value pairs in file order, see ofp::readEntries()
+ */
+void printValues(const std::vector<std::string>& keys,
+                 std::map<std::string, std::string>& keyValueMap,
+                 const ofp::KeyIndex::Entries& entries, bool sortedEnabled,
+                 bool verboseEnabled) {
+  // patterns are answered from an index over all keys, see ofp::KeyIndex
+  ofp::KeyIndex keyIndex(entries);
+  for (auto& key : keys) {
+    if (ofp::isPattern(key)) {
+      for (std::size_t match : keyIndex.match(key, sortedEnabled)) {
+        std::cout << entries[match].first << "=" << entries[match].second
+                  << std::endl;
+      }
+      continue;
+    }
+    if (verboseEnabled) std::cerr << key << "=";
+    std::cout << keyValueMap[key] << std::endl;
+  }
+}
+
+/**
+ * @brief publishes the entries to the shared memory segment
+ *
+ * @return exit code of the app
+ */
+int publishEntries(const std::string& sharedTableName,
+                   const ofp::KeyIndex::Entries& entries, bool statsEnabled) {
+  ofp::SharedTable::Stats stats;
+  if (!ofp::SharedTable::publish(sharedTableName.c_str(), entries, &stats)) {
+    std::cerr << APP_NAME "Failed to publish to shared memory segment: '"
+              << sharedTableName << "': " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  if (statsEnabled) {
+    std::cerr << APP_NAME "Shared table version: " << stats.version
+              << std::endl
+              << APP_NAME "Shared table size: " << stats.entries
+              << " entries, " << stats.bytes << " bytes" << std::endl
+              << APP_NAME "Shared table memory per entry: " << std::fixed
+              << std::setprecision(1) << stats.bytesPerEntry()
+              << " bytes of id pairs and string table, "
+              << stats.slot_bytes << " bytes of slots, " << stats.span_bytes
+              << " bytes of string table" << std::endl
+              << APP_NAME "Interning hit rate: "
+              << 100 * stats.strings.hitRate()
+              << " % of " << stats.strings.lookups << " strings, "
+              << stats.strings.bytesSaved() << " bytes saved" << std::endl;
+  }
+  return 0;
+}
+
+/**
+ * @brief renders the templates with the entries, see ofp::renderFiles()
+ *
+ * @return exit code of the app
+ */
+int renderTemplates(const std::vector<std::string>& templates,
+                    const ofp::KeyIndex::Entries& entries, bool statsEnabled) {
+  auto renderStart = std::chrono::steady_clock::now();
+  ofp::RenderIndex index(entries);
+  std::vector<ofp::RenderResult> results = ofp::renderFiles(templates, index);
+  int exitCode = 0;
+  std::size_t placeholders = 0, bytes = 0;
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    placeholders += results[i].placeholders;
+    bytes += results[i].bytes;
+    for (auto& key : results[i].missing) {
+      std::cerr << APP_NAME "Missing key '" << key << "' in template: '"
+                << templates[i] << "'" << std::endl;
+      exitCode = std::max(exitCode, 1);
+    }
+    if (!results[i].missing.empty()) continue;
+    if (!results[i].ok) {
+      std::cerr << APP_NAME "Failed to render template: '" << templates[i]
+                << "'" << std::endl;
+      exitCode = -1;
+      continue;
+    }
+    std::cout << results[i].output;
+  }
+  std::cout << std::flush;
+  auto renderTime = std::chrono::steady_clock::now() - renderStart;
+  if (statsEnabled) {
+    std::cerr << APP_NAME "Rendered: " << templates.size() << " templates, "
+              << placeholders << " placeholders, " << bytes << " bytes in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(
+                     renderTime)
+                     .count()
+              << " us" << std::endl;
+  }
+  return exitCode;
 }
 
-inline std::string ltrim(const std::string& s) {
-	return std::regex_replace(s, std::regex("^\\s+"), std::string(""));
+/**
+ * @brief prints the selected entries as shell assignments, or executes the
+ * command with them in its environment
+ *
+ * @param execArgv command and its arguments, nullptr to print
+ * @return exit code of the app
+ */
+int exportEntries(const ofp::KeyIndex::Entries& entries,
+                  const std::vector<std::string>& keys,
+                  char* const execArgv[]) {
+  std::vector<std::string> missing;
+  std::vector<std::size_t> positions =
+      ofp::selectEntries(entries, keys, missing);
+  for (auto& key : missing) {
+    std::cerr << APP_NAME "Missing key: '" << key << "'" << std::endl;
+  }
+  if (!missing.empty()) return 1;
+  bool reserved = false;
+  for (std::size_t i : positions) {
+    std::string name = ofp::shellName(entries[i].first);
+    if (ofp::reservedName(name)) {
+      std::cerr << APP_NAME "Key '" << entries[i].first
+                << "' would set the reserved variable " << name << std::endl;
+      reserved = true;
+    }
+  }
+  if (reserved) return 1;
+  if (!execArgv) {
+    std::cout << ofp::shellAssignments(entries, positions) << std::flush;
+    return 0;
+  }
+  ofp::execWithEntries(entries, positions, execArgv);
+  std::cerr << APP_NAME "Failed to execute: '" << execArgv[0]
+            << "': " << std::strerror(errno) << std::endl;
+  return 127;  // like a shell
 }
 
-inline std::string rtrim(const std::string& s) {
-	return std::regex_replace(s, std::regex("\\s+$"), std::string(""));
+/**
+ * @brief reports the result of EXISTS, the missing keys only if verbose
+ *
+ * @param present one flag per key
+ * @return 0 if all keys are present, 1 if some and 2 if none are
+ */
+int presenceExitCode(const std::vector<std::string>& keys,
+                     const std::vector<bool>& present, bool verboseEnabled) {
+  std::size_t count = std::count(present.begin(), present.end(), true);
+  if (verboseEnabled) {
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      if (!present[i]) {
+        std::cerr << APP_NAME "Missing key: '" << keys[i] << "'" << std::endl;
+      }
+    }
+  }
+  if (count == keys.size()) return 0;
+  return count > 0 ? 1 : 2;
 }
 
-inline std::string trim(const std::string& s) {
-	return ltrim(rtrim(s));
+/**
+ * @brief READ, WRITE or DELETE as filter from the file to the output, see
+ * option_stream.hpp. READ writes the values to the output.
+ *
+ * @param path file to read, "-" for stdin
+ * @param outputPath file to write, "-" or empty for stdout
+ * @return exit code of the app
+ */
+int streamFile(ModifyKeysMode mode, const char* path,
+               const std::string& outputPath,
+               const std::vector<std::pair<std::string, std::string>>& writes,
+               const std::vector<std::string>& keys, bool statsEnabled) {
+  bool fromStdin = std::strcmp(path, "-") == 0;
+  if (!fromStdin && ofp::compressionOf(path) != ofp::Compression::none) {
+    std::cerr << APP_NAME "Compressed files can not be streamed: '" << path
+              << "'" << std::endl;
+    return -1;
+  }
+  if (mode == ModifyKeysMode::read &&
+      std::any_of(keys.begin(), keys.end(),
+                  [](const std::string& key) { return ofp::isPattern(key); })) {
+    std::cerr << APP_NAME "Patterns can not be READ from a stream"
+              << std::endl;
+    return -1;
+  }
+  int in = fromStdin ? STDIN_FILENO : ::open(path, O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    std::cerr << APP_NAME "Failed to open file: '" << path << "'"
+              << std::endl;
+    return -1;
+  }
+
+  ofp::StreamStats stats;
+  std::vector<std::optional<std::string>> values;
+  std::function<bool(int)> writeOutput;
+  if (mode == ModifyKeysMode::read) {
+    std::cerr << APP_NAME "Mode: READ (stream)" << std::endl;
+    if (!ofp::streamValues(in, keys, values, &stats)) {
+      std::cerr << APP_NAME "Failed to read file: '" << path << "': "
+                << std::strerror(errno) << std::endl;
+      return -1;
+    }
+    writeOutput = [&values](int fd) {
+      std::string out;
+      for (auto& value : values) {
+        out += value.value_or("");
+        out += '\n';
+      }
+      return ofp::detail::writeAll(fd, out.data(), out.size());
+    };
+  } else {
+    std::cerr << APP_NAME "Mode: "
+              << (mode == ModifyKeysMode::write ? "WRITE" : "DELETE")
+              << " (stream)" << std::endl;
+    // one of both is empty
+    writeOutput = [&](int fd) {
+      return ofp::streamEdits(in, fd, writes, keys, &stats);
+    };
+  }
+  bool toStdout = outputPath.empty() || outputPath == "-";
+  ofp::FileLock lock;  // held until an existing output file is replaced
+  if (!toStdout) lock.lock(outputPath.c_str());
+  bool ok = toStdout ? writeOutput(STDOUT_FILENO)
+                     : ofp::replaceFileWith(outputPath.c_str(), writeOutput);
+  if (!fromStdin) ::close(in);
+  if (!ok) {
+    std::cerr << APP_NAME "Failed to stream file: '" << path << "': "
+              << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  if (statsEnabled) {
+    std::cerr << APP_NAME "Streamed: " << stats.input_bytes << " bytes, "
+              << stats.lines << " lines, " << stats.edits << " edits, "
+              << std::fixed << std::setprecision(1)
+              << stats.throughput() / 1e6 << " MB/s" << std::endl;
+  }
+  return 0;
 }
 
+/**
+ * @brief ofp::readEntries() in the format chosen on the command line
+ */
+ofp::KeyIndex::Entries readEntriesAs(
+    ofp::FileFormat format, const std::vector<std::string_view>& lines) {
+  switch (format) {
+    case ofp::FileFormat::colon:
+      return ofp::readEntries<ofp::ColonFormat>(lines);
+    case ofp::FileFormat::space:
+      return ofp::readEntries<ofp::SpaceFormat>(lines);
+    default:
+      return ofp::readEntries(lines);
+  }
+}
+
+/**
+ * @brief ofp::readCompressedEntries() in the format chosen on the command
+ * line
+ */
+template <typename Wanted>
+bool readCompressedEntriesAs(ofp::FileFormat format, const char* path,
+                             ofp::Compression compression, Wanted wanted,
+                             ofp::KeyIndex::Entries& entries) {
+  switch (format) {
+    case ofp::FileFormat::colon:
+      return ofp::readCompressedEntries<ofp::ColonFormat>(path, compression,
+                                                          wanted, entries);
+    case ofp::FileFormat::space:
+      return ofp::readCompressedEntries<ofp::SpaceFormat>(path, compression,
+                                                          wanted, entries);
+    default:
+      return ofp::readCompressedEntries(path, compression, wanted, entries);
+  }
+}
+
+/**
+ * @brief parses a size like "512K", "64M" or "2G"
+ *
+ * @return false if the size is malformed
+ */
+bool parseSize(const char* arg, std::size_t& size) {
+  char* end = nullptr;
+  size = std::strtoull(arg, &end, 10);
+  if (end == arg) return false;
+  switch (*end) {
+    case 'G':
+      size <<= 10;
+      [[fallthrough]];
+    case 'M':
+      size <<= 10;
+      [[fallthrough]];
+    case 'K':
+      size <<= 10;
+      ++end;
+      break;
+    default:
+      break;
+  }
+  return *end == '\0';
+}
+
+/**
+ * @brief parses one operation of a transaction, see print_help()
+ *
+ * @return false if the operation is malformed
+ */
+bool parseTransactionOperation(const std::string& arg, ofp::Transaction& txn) {
+  std::size_t space = arg.find(' ');
+  if (space == std::string::npos) return false;
+  std::string operation = arg.substr(0, space);
+  std::string operand = trim(arg.substr(space + 1));
+  std::size_t eq_pos = operand.find('=');
+  bool isPair = eq_pos != std::string::npos && eq_pos > 0 &&
+                eq_pos < operand.size() - 1;
+  bool isKey = !operand.empty() && eq_pos == std::string::npos;
+
+  if (operation == "set" && isPair) {
+    txn.writes.emplace_back(trim(operand.substr(0, eq_pos)),
+                            trim(operand.substr(eq_pos + 1)));
+  } else if (operation == "del" && isKey) {
+    txn.deletes.emplace_back(operand);
+  } else if (operation == "expect" && isPair) {
+    txn.expected.emplace_back(trim(operand.substr(0, eq_pos)),
+                              trim(operand.substr(eq_pos + 1)));
+  } else if (operation == "absent" && isKey) {
+    txn.expected.emplace_back(operand, std::nullopt);
+  } else if (operation == "version" && isKey) {
+    char* end = nullptr;
+    txn.version = std::strtoull(operand.c_str(), &end, 16);
+    if (*end != '\0') return false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief adds the lines of the file to the arguments, see
+ * ofp::ArgumentList::addFile()
+ *
+ * @return false after printing an error if the file can not be read
+ */
+bool addArgumentFile(ofp::ArgumentList& arguments, const char* path) {
+  if (arguments.addFile(path)) return true;
+  std::cerr << APP_NAME "Could not read arguments from '" << path
+            << "': " << std::strerror(errno) << std::endl;
+  print_help();
+  return false;
+}
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
@@ -64,12 +628,79 @@ int main(int argc, char* argv[]) {
   int opt = -1;
   char file_to_parse_name[256] = {0};
   bool verboseEnabled = false;
+  bool statsEnabled = false;
+  bool journalEnabled = false;
+  bool sortedEnabled = false;
+  bool diffEnabled = false;
+  std::size_t journalLimit = 1024;
+  std::size_t memoryBudget = 64 << 20;
+  std::string sharedTableName;
+  std::string searchText;
+  std::string changesetPath;
+  std::string codegenNamespace;
+  std::string outputPath;
+  ofp::IoEngine ioEngine = ofp::IoEngine::blocking;
+  ofp::FileFormat fileFormat = ofp::FileFormat::equals;
   ModifyKeysMode mode = ModifyKeysMode::undefined;
 
-  std::list<std::string> keysToReadOrDelete;
-  std::list<std::pair<std::string, std::string>> keysToWrite;
+  std::vector<std::string> keysToReadOrDelete;
+  std::vector<const char*> keyFiles;
+  std::vector<std::pair<std::string, std::string>> keysToWrite;
+  std::vector<std::string> filesToSearch;
+  std::vector<std::string> templateFiles;
+  ofp::Transaction transaction;
+
+  auto selectMode = [&mode](ModifyKeysMode selected) {
+    if (mode != ModifyKeysMode::undefined && mode != selected) {
+      std::cerr << "Only one mode of READ, WRITE, DELETE, COMPACT, "
+                   "TRANSACTION, PUBLISH, SEARCH, APPLY, HASH, "
+                   "NORMALIZE, CODEGEN, RENDER, EXPORT, EXEC and EXISTS can "
+                   "be used"
+                << std::endl;
+      print_help();
+      return false;
+    }
+    mode = selected;
+    return true;
+  };
+
+  // everything after --exec is the command, getopt must not see its options
+  char** execArgv = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--exec") == 0) {
+      execArgv = argv + i + 1;
+      argc = i;
+      if (!selectMode(ModifyKeysMode::exec)) return -1;
+      break;
+    }
+  }
+  if (execArgv && !*execArgv) {
+    std::cerr << APP_NAME "Specify a command to EXEC" << std::endl;
+    print_help();
+    return -1;
+  }
+
+  static const struct option longOptions[] = {
+      {"publish", required_argument, nullptr, 'P'},
+      {"shm", required_argument, nullptr, 'm'},
+      {"output", required_argument, nullptr, 'o'},
+      {"sorted", no_argument, nullptr, kOptionSorted},
+      {"search", required_argument, nullptr, kOptionSearch},
+      {"io", required_argument, nullptr, kOptionIo},
+      {"diff", no_argument, nullptr, kOptionDiff},
+      {"apply", required_argument, nullptr, kOptionApply},
+      {"hash", no_argument, nullptr, kOptionHash},
+      {"normalize", no_argument, nullptr, kOptionNormalize},
+      {"memory-budget", required_argument, nullptr, kOptionMemoryBudget},
+      {"codegen", required_argument, nullptr, kOptionCodegen},
+      {"format", required_argument, nullptr, kOptionFormat},
+      {"render", no_argument, nullptr, kOptionRender},
+      {"export", no_argument, nullptr, kOptionExport},
+      {"keys-from", required_argument, nullptr, kOptionKeysFrom},
+      {nullptr, 0, nullptr, 0}};
 
-  while ((opt = getopt(argc, argv, "hvf:wrd")) != -1) {
+  while ((opt = getopt_long(argc, argv, "hvSf:o:wrdejl:ctP:m:", longOptions,
+                            nullptr)) != -1) {
     switch (opt) {
       case 'h':
         print_help();
@@ -77,75 +708,238 @@ int main(int argc, char* argv[]) {
       case 'v':
         verboseEnabled = true;
         break;
+      case 'S':
+        statsEnabled = true;
+        break;
       case 'f':
         snprintf(file_to_parse_name, 256, "%s", optarg);
         break;
-      case 'w': {
-        if (mode != ModifyKeysMode::undefined &&
-            mode != ModifyKeysMode::write) {
-          std::cerr << "READ, WRITE and DELETE can not be used together"
+      case 'o':
+        outputPath = optarg;
+        break;
+      case 'w':
+        if (!selectMode(ModifyKeysMode::write)) return -1;
+        break;
+      case 'r':
+        if (!selectMode(ModifyKeysMode::read)) return -1;
+        break;
+      case 'd':
+        if (!selectMode(ModifyKeysMode::remove)) return -1;
+        break;
+      case 'e':
+        if (!selectMode(ModifyKeysMode::exists)) return -1;
+        break;
+      case 'c':
+        if (!selectMode(ModifyKeysMode::compact)) return -1;
+        break;
+      case 't':
+        if (!selectMode(ModifyKeysMode::transaction)) return -1;
+        break;
+      case 'P':
+        if (!selectMode(ModifyKeysMode::publish)) return -1;
+        sharedTableName = optarg;
+        break;
+      case 'm':
+        sharedTableName = optarg;
+        break;
+      case kOptionSorted:
+        sortedEnabled = true;
+        break;
+      case kOptionSearch:
+        if (!selectMode(ModifyKeysMode::search)) return -1;
+        searchText = optarg;
+        break;
+      case kOptionIo:
+        if (!ofp::parseIoEngine(optarg, ioEngine)) {
+          std::cerr << APP_NAME "Unknown I/O engine: '" << optarg << "'"
                     << std::endl;
           print_help();
           return -1;
         }
-        mode = ModifyKeysMode::write;
         break;
-      }
-      case 'r':
-        if (mode != ModifyKeysMode::undefined && mode != ModifyKeysMode::read) {
-          std::cerr << "READ, WRITE and DELETE can not be used together"
+      case kOptionDiff:
+        diffEnabled = true;
+        break;
+      case kOptionApply:
+        if (!selectMode(ModifyKeysMode::apply)) return -1;
+        changesetPath = optarg;
+        break;
+      case kOptionHash:
+        if (!selectMode(ModifyKeysMode::hash)) return -1;
+        break;
+      case kOptionNormalize:
+        if (!selectMode(ModifyKeysMode::normalize)) return -1;
+        break;
+      case kOptionExport:
+        if (!selectMode(ModifyKeysMode::exportShell)) return -1;
+        break;
+      case kOptionKeysFrom:
+        keyFiles.push_back(optarg);
+        break;
+      case kOptionRender:
+        if (!selectMode(ModifyKeysMode::render)) return -1;
+        break;
+      case kOptionFormat:
+        if (!ofp::parseFileFormat(optarg, fileFormat)) {
+          std::cerr << APP_NAME "Unknown format: '" << optarg << "'"
                     << std::endl;
           print_help();
           return -1;
         }
-        mode = ModifyKeysMode::read;
         break;
-      case 'd':
-        if (mode != ModifyKeysMode::undefined &&
-            mode != ModifyKeysMode::remove) {
-          std::cerr << "READ, WRITE and DELETE can not be used together"
-                    << std::endl;
+      case kOptionCodegen:
+        if (!selectMode(ModifyKeysMode::codegen)) return -1;
+        if (!ofp::isNamespaceName(optarg)) {
+          std::cerr << APP_NAME "Not a valid C++ namespace: '" << optarg
+                    << "'" << std::endl;
           print_help();
           return -1;
         }
-        mode = ModifyKeysMode::remove;
+        codegenNamespace = optarg;
+        break;
+      case kOptionMemoryBudget:
+        if (!parseSize(optarg, memoryBudget)) {
+          std::cerr << APP_NAME "Wrong format of memory budget: '" << optarg
+                    << "'" << std::endl;
+          print_help();
+          return -1;
+        }
+        break;
+      case 'j':
+        journalEnabled = true;
+        break;
+      case 'l':
+        journalLimit = std::strtoull(optarg, nullptr, 10);
+        if (journalLimit == 0) journalLimit = SIZE_MAX;
         break;
       default:
         break;
     }
   }
 
-  if (strlen(file_to_parse_name) == 0) {
+  // "@<file>" arguments and --keys-from files hold one argument per line,
+  // the latter follow the arguments
+  ofp::ArgumentList arguments;
+  bool streamInput = std::strcmp(file_to_parse_name, "-") == 0;
+  auto addArguments = [&](const char* path) {
+    if (streamInput && std::strcmp(path, "-") == 0) {
+      std::cerr << APP_NAME "stdin can not hold both the file and arguments"
+                << std::endl;
+      print_help();
+      return false;
+    }
+    return addArgumentFile(arguments, path);
+  };
+  for (int i = optind; i < argc; ++i) {
+    if (argv[i][0] != '@' || argv[i][1] == '\0') {
+      arguments.add(argv[i]);
+    } else if (!addArguments(argv[i] + 1)) {
+      return -1;
+    }
+  }
+  for (const char* path : keyFiles) {
+    if (!addArguments(path)) return -1;
+  }
+
+  if (!sharedTableName.empty() && sharedTableName[0] != '/') {
+    sharedTableName.insert(0, "/");
+  }
+
+  if (strlen(file_to_parse_name) == 0 &&
+      ((mode != ModifyKeysMode::read && mode != ModifyKeysMode::exists) ||
+       sharedTableName.empty()) &&
+      (mode != ModifyKeysMode::search || arguments.empty())) {
     std::cerr << APP_NAME "Please specify a file path" << std::endl;
     print_help();
     return -1;
   }
 
   if (mode == ModifyKeysMode::undefined) {
-    std::cerr << APP_NAME "Please specify a mode: READ, WRITE or DELETE" << std::endl;
+    std::cerr << APP_NAME "Please specify a mode: READ, WRITE, DELETE, COMPACT, "
+                          "TRANSACTION, PUBLISH, SEARCH, APPLY, HASH, "
+                          "NORMALIZE, CODEGEN, RENDER, EXPORT, EXEC or "
+                          "EXISTS"
+              << std::endl;
     print_help();
     return -1;
   }
 
-  // read the command line arguments
-  for (int i = optind; i < argc; ++i) {
-    std::string arg(argv[i]);
+  if (fileFormat != ofp::FileFormat::equals &&
+      mode != ModifyKeysMode::read && mode != ModifyKeysMode::publish &&
+      mode != ModifyKeysMode::codegen && mode != ModifyKeysMode::render &&
+      mode != ModifyKeysMode::exportShell && mode != ModifyKeysMode::exec) {
+    std::cerr << APP_NAME "Only READ, PUBLISH, CODEGEN, RENDER, EXPORT and "
+                          "EXEC support other formats than <key>=<value>"
+              << std::endl;
+    print_help();
+    return -1;
+  }
+
+  if ((streamInput || !outputPath.empty()) &&
+      ((mode != ModifyKeysMode::read && mode != ModifyKeysMode::write &&
+        mode != ModifyKeysMode::remove) ||
+       journalEnabled || diffEnabled || !sharedTableName.empty() ||
+       fileFormat != ofp::FileFormat::equals)) {
+    std::cerr << APP_NAME "Only READ, WRITE and DELETE without -j, --diff, "
+                          "-m and --format can stream with -f - or -o"
+              << std::endl;
+    print_help();
+    return -1;
+  }
+
+  // read the command line arguments, keys are deduplicated as views into
+  // them and copied once
+  ofp::KeyList keyList;
+  ofp::WriteList writeList;
+  for (std::string_view arg : arguments) {
     std::size_t eq_pos = arg.find_first_of("=", 0);
 
-    if (mode == ModifyKeysMode::read || mode == ModifyKeysMode::remove) {
+    if (mode == ModifyKeysMode::read || mode == ModifyKeysMode::remove ||
+        mode == ModifyKeysMode::exportShell || mode == ModifyKeysMode::exec ||
+        mode == ModifyKeysMode::exists) {
+      if (mode == ModifyKeysMode::exists && ofp::isPattern(arg)) {
+        std::cerr << "EXISTS takes keys, no patterns | Got '" << arg << "'"
+                  << std::endl;
+        print_help();
+        return -1;
+      }
       if (eq_pos == std::string::npos) {
-        keysToReadOrDelete.emplace_back(trim(arg));
+        keyList.add(trim(arg));
       } else {
         std::cerr << "Wrong format of options - Expected <key> | Got '" << arg
                   << "'" << std::endl;
         print_help();
         return -1;
       }
+    } else if (mode == ModifyKeysMode::search) {
+      filesToSearch.emplace_back(arg);
+    } else if (mode == ModifyKeysMode::render) {
+      templateFiles.emplace_back(arg);
+    } else if (mode == ModifyKeysMode::transaction) {
+      if (!parseTransactionOperation(std::string(arg), transaction)) {
+        std::cerr << "Wrong format of transaction - Expected set <key>=<value> "
+                     "| del <key> | expect <key>=<value> | absent <key> | "
+                     "version <version> | Got '"
+                  << arg << "'" << std::endl;
+        print_help();
+        return -1;
+      }
+    } else if (mode == ModifyKeysMode::compact ||
+               mode == ModifyKeysMode::publish ||
+               mode == ModifyKeysMode::apply || mode == ModifyKeysMode::hash ||
+               mode == ModifyKeysMode::normalize ||
+               mode == ModifyKeysMode::codegen) {
+      std::cerr << "COMPACT, PUBLISH, APPLY, HASH, NORMALIZE and CODEGEN do "
+                   "not take any keys | Got '"
+                << arg
+                << "'" << std::endl;
+      print_help();
+      return -1;
     } else if (mode == ModifyKeysMode::write) {
       if (eq_pos != std::string::npos && eq_pos > 0 &&
           eq_pos < arg.size() - 1) {
-        keysToWrite.emplace_back(trim(arg.substr(0, eq_pos)),
-                                 trim(arg.substr(eq_pos + 1, arg.size())));
+        writeList.set(trim(arg.substr(0, eq_pos)),
+                      trim(arg.substr(eq_pos + 1, arg.size())));
       } else {
         std::cerr << "Wrong format to set key - Expected <key>=<value> | Got '"
                   << arg << "'" << std::endl;
@@ -155,19 +949,28 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  keysToWrite.unique([](std::pair<std::string, std::string>& a,
-                        std::pair<std::string, std::string>& b) {
-    return (a.first == b.first);
-  });
+  keysToReadOrDelete.assign(keyList.begin(), keyList.end());
+  keysToWrite.assign(writeList.begin(), writeList.end());
 
-  if (keysToReadOrDelete.empty() && keysToWrite.empty() &&
-      keysToReadOrDelete.empty()) {
+  if (mode != ModifyKeysMode::compact && mode != ModifyKeysMode::publish &&
+      mode != ModifyKeysMode::search && mode != ModifyKeysMode::apply &&
+      mode != ModifyKeysMode::hash && mode != ModifyKeysMode::normalize &&
+      mode != ModifyKeysMode::codegen && mode != ModifyKeysMode::render &&
+      mode != ModifyKeysMode::exportShell && mode != ModifyKeysMode::exec &&
+      keysToReadOrDelete.empty() && keysToWrite.empty() && arguments.empty()) {
     std::cerr << APP_NAME << "Specify at least one key to READ, WRITE or DELETE"
               << std::endl;
     print_help();
     return -1;
   }
 
+  if (mode == ModifyKeysMode::render && templateFiles.empty()) {
+    std::cerr << APP_NAME "Specify at least one template to RENDER"
+              << std::endl;
+    print_help();
+    return -1;
+  }
+
   if (verboseEnabled) {
     std::cerr << APP_NAME "File to parse: " << file_to_parse_name << std::endl;
     if (!keysToWrite.empty()) {
@@ -186,102 +989,529 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  // work on the file
-  std::ifstream input_file(file_to_parse_name);
-  std::string input_line;
-  std::list<std::string> all_file_lines;
+  // look keys up in the shared table, without touching the file
+  if (mode == ModifyKeysMode::exists && !sharedTableName.empty()) {
+    std::cerr << APP_NAME "Mode: EXISTS (shared memory)" << std::endl;
+    ofp::SharedTable table;
+    if (!table.open(sharedTableName.c_str())) {
+      std::cerr << APP_NAME "Failed to open shared memory segment: '"
+                << sharedTableName << "'" << std::endl;
+      return -1;
+    }
+    std::vector<bool> present;
+    std::optional<std::string> value;
+    for (auto& key : keysToReadOrDelete) {
+      if (!table.lookup(key, value)) {
+        std::cerr << APP_NAME "Failed to read shared memory segment: '"
+                  << sharedTableName << "': " << std::strerror(errno)
+                  << std::endl;
+        return -1;
+      }
+      present.push_back(value.has_value());
+    }
+    return presenceExitCode(keysToReadOrDelete, present, verboseEnabled);
+  }
+  if (mode == ModifyKeysMode::read && !sharedTableName.empty()) {
+    std::cerr << APP_NAME "Mode: READ (shared memory)" << std::endl;
+    ofp::SharedTable table;
+    if (!table.open(sharedTableName.c_str())) {
+      std::cerr << APP_NAME "Failed to open shared memory segment: '"
+                << sharedTableName << "'" << std::endl;
+      return -1;
+    }
+    // all values are looked up before any is printed, a failed lookup
+    // prints nothing
+    std::vector<std::optional<std::string>> values(keysToReadOrDelete.size());
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      if (!table.lookup(keysToReadOrDelete[i], values[i])) {
+        std::cerr << APP_NAME "Failed to read shared memory segment: '"
+                  << sharedTableName << "': " << std::strerror(errno)
+                  << std::endl;
+        return -1;
+      }
+    }
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      if (verboseEnabled) std::cerr << keysToReadOrDelete[i] << "=";
+      std::cout << values[i].value_or("") << std::endl;
+    }
+    if (statsEnabled) {
+      std::cerr << APP_NAME "Shared table version: " << table.version()
+                << std::endl;
+    }
+    return 0;
+  }
 
-  auto lineHasKey = [](std::string& line, std::string& key) {
-    std::size_t eq_pos = line.find_first_of("=", 0);
-    if (eq_pos != std::string::npos && eq_pos > 0 && eq_pos < line.size() - 1) {
-      if (trim(line.substr(0, eq_pos)) == key) {
-        return eq_pos;
+  if (mode == ModifyKeysMode::search) {
+    std::cerr << APP_NAME "Mode: SEARCH" << std::endl;
+    if (strlen(file_to_parse_name) > 0) {
+      filesToSearch.insert(filesToSearch.begin(), file_to_parse_name);
+    }
+    auto searchStart = std::chrono::steady_clock::now();
+    ofp::SearchPattern pattern(searchText);
+    std::size_t matches = 0;
+    std::size_t bytes = 0;
+    std::size_t fileCount = filesToSearch.size();
+    auto searchFile = [&](const std::string& path, std::string_view content) {
+      bytes += content.size();
+      matches += ofp::searchValues(
+          content, pattern,
+          [&](std::string_view section, std::string_view key,
+              std::string_view value) {
+            if (fileCount > 1) std::cout << path << ":";
+            std::cout << ofp::qualifiedKey(section, key) << "=" << value
+                      << "\n";
+          });
+    };
+    std::vector<std::string> paths;
+    for (auto& path : filesToSearch) {
+      if (ofp::compressionOf(path) != ofp::Compression::none) {
+        std::cerr << APP_NAME "Compressed files can not be searched: '"
+                  << path << "'" << std::endl;
+      } else {
+        paths.push_back(path);
       }
     }
-    return std::string::npos;
-  };
+    if (ioEngine == ofp::IoEngine::uring) {
+      // parse every file as soon as it is read, while others are in flight
+      auto searchRead = [&](std::size_t index, bool ok,
+                            std::string_view content) {
+        if (ok) {
+          searchFile(paths[index], content);
+        } else {
+          std::cerr << APP_NAME "Failed to open file: '" << paths[index]
+                    << "'" << std::endl;
+        }
+      };
+      ofp::readFiles(paths, ioEngine, searchRead);
+    } else {
+      for (auto& path : paths) {
+        ofp::MappedFile file;
+        if (!file.open(path.c_str())) {
+          std::cerr << APP_NAME "Failed to open file: '" << path << "'"
+                    << std::endl;
+          continue;
+        }
+        searchFile(path, file.view());
+      }
+    }
+    std::cout << std::flush;
+    auto searchTime = std::chrono::steady_clock::now() - searchStart;
+    if (statsEnabled) {
+      std::cerr << APP_NAME "Searched: " << filesToSearch.size() << " files, "
+                << bytes << " bytes, " << matches << " matches in "
+                << std::chrono::duration_cast<std::chrono::microseconds>(
+                       searchTime)
+                       .count()
+                << " us" << std::endl;
+    }
+    return matches > 0 ? 0 : 1;
+  }
+
+  // filter from -f to -o, '-' stands for stdin and stdout
+  if (streamInput || !outputPath.empty()) {
+    return streamFile(mode, file_to_parse_name, outputPath, keysToWrite,
+                      keysToReadOrDelete, statsEnabled);
+  }
+
+  ofp::Compression compression = ofp::compressionOf(file_to_parse_name);
+  if (!ofp::compressionSupported(compression)) {
+    std::cerr << APP_NAME "Compressed files are not supported by this build: '"
+              << file_to_parse_name << "'" << std::endl;
+    return -1;
+  }
+  if (compression != ofp::Compression::none &&
+      (mode == ModifyKeysMode::transaction || mode == ModifyKeysMode::apply ||
+       (journalEnabled && !diffEnabled &&
+        (mode == ModifyKeysMode::write || mode == ModifyKeysMode::remove)))) {
+    std::cerr << APP_NAME "TRANSACTION, APPLY and the journal require an "
+                          "uncompressed file"
+              << std::endl;
+    print_help();
+    return -1;
+  }
+
+  if (mode == ModifyKeysMode::transaction) {
+    std::cerr << APP_NAME "Mode: TRANSACTION" << std::endl;
+    std::uint64_t version = 0;
+    ofp::TransactionResult result =
+        ofp::commitTransaction(file_to_parse_name, transaction, &version);
+    if (result == ofp::TransactionResult::failed) {
+      std::cerr << APP_NAME "Failed to update file: '" << file_to_parse_name
+                << "'" << std::endl;
+      return -1;
+    }
+    std::cout << std::hex << std::setw(16) << std::setfill('0') << version
+              << std::endl;
+    if (result == ofp::TransactionResult::conflict) {
+      std::cerr << APP_NAME "Transaction precondition failed, nothing written"
+                << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (mode == ModifyKeysMode::apply) {
+    std::cerr << APP_NAME "Mode: APPLY" << std::endl;
+    std::string changesetText;
+    if (changesetPath == "-") {
+      changesetText.assign(std::istreambuf_iterator<char>(std::cin),
+                           std::istreambuf_iterator<char>());
+    } else {
+      std::ifstream changesetFile(changesetPath, std::ios::binary);
+      if (!changesetFile) {
+        std::cerr << APP_NAME "Failed to open file: '" << changesetPath << "'"
+                  << std::endl;
+        return -1;
+      }
+      changesetText.assign(std::istreambuf_iterator<char>(changesetFile),
+                           std::istreambuf_iterator<char>());
+    }
+    ofp::Changeset changeset;
+    if (!ofp::parseChangeset(changesetText, changeset)) {
+      std::cerr << APP_NAME "Malformed changeset: '" << changesetPath << "'"
+                << std::endl;
+      return -1;
+    }
+    std::uint64_t version = 0;
+    ofp::TransactionResult result =
+        ofp::applyChangeset(file_to_parse_name, changeset, &version);
+    if (result == ofp::TransactionResult::failed) {
+      std::cerr << APP_NAME "Failed to update file: '" << file_to_parse_name
+                << "'" << std::endl;
+      return -1;
+    }
+    std::cout << std::hex << std::setw(16) << std::setfill('0') << version
+              << std::endl;
+    if (result == ofp::TransactionResult::conflict) {
+      std::cerr << APP_NAME "Changeset does not match the file, nothing "
+                            "written"
+                << std::endl;
+      return 1;
+    }
+    if (statsEnabled) {
+      std::cerr << APP_NAME "Changeset: " << changeset.hunks.size()
+                << " hunks applied" << std::endl;
+    }
+    return 0;
+  }
+
+  // append to the journal, without reading the file
+  if (journalEnabled && !diffEnabled &&
+      (mode == ModifyKeysMode::write || mode == ModifyKeysMode::remove)) {
+    std::cerr << APP_NAME "Mode: "
+              << (mode == ModifyKeysMode::write ? "WRITE" : "DELETE")
+              << " (journal)" << std::endl;
+    std::vector<std::string> records;
+    for (auto& keyValuePair : keysToWrite) {
+      records.emplace_back(
+          ofp::journalRecord(keyValuePair.first, keyValuePair.second));
+    }
+    for (auto& key : keysToReadOrDelete) {
+      records.emplace_back(ofp::journalTombstone(key));
+    }
+    if (!ofp::appendJournal(file_to_parse_name, records)) {
+      std::cerr << APP_NAME "Failed to open file: '" << file_to_parse_name
+                << "'" << std::endl;
+      return -1;
+    }
+    std::size_t journalLength =
+        ofp::countJournalRecords(file_to_parse_name, journalLimit);
+    if (statsEnabled) {
+      std::cerr << APP_NAME "Journal length: " << journalLength << " records"
+                << (journalLength > journalLimit ? " (over limit)" : "")
+                << std::endl;
+    }
+    if (journalLength <= journalLimit) return 0;
+    // compact automatically once the journal grew too long
+    mode = ModifyKeysMode::compact;
+    keysToWrite.clear();
+    keysToReadOrDelete.clear();
+  }
+
+  // EXEC and EXPORT fail like a shell which can not run the command
+  int readFailedCode = mode == ModifyKeysMode::exec ||
+                               mode == ModifyKeysMode::exportShell
+                           ? 127
+                           : -1;
+
+  // stream a compressed file through the parser, keeping only what is needed
+  if (compression != ofp::Compression::none &&
+      (mode == ModifyKeysMode::read || mode == ModifyKeysMode::publish ||
+       mode == ModifyKeysMode::codegen || mode == ModifyKeysMode::render ||
+       mode == ModifyKeysMode::exportShell || mode == ModifyKeysMode::exec)) {
+    std::cerr << APP_NAME "Mode: "
+              << (mode == ModifyKeysMode::read          ? "READ"
+                  : mode == ModifyKeysMode::publish     ? "PUBLISH"
+                  : mode == ModifyKeysMode::codegen     ? "CODEGEN"
+                  : mode == ModifyKeysMode::render      ? "RENDER"
+                  : mode == ModifyKeysMode::exportShell ? "EXPORT"
+                                                        : "EXEC")
+              << " (compressed)" << std::endl;
+    std::set<std::string> keys;
+    std::vector<std::string> patterns;
+    for (auto& key : keysToReadOrDelete) {
+      if (ofp::isPattern(key)) {
+        patterns.push_back(key);
+      } else {
+        keys.insert(key);
+      }
+    }
+    auto wanted = [&](const std::string& key) {
+      if (mode != ModifyKeysMode::read || keys.count(key)) return true;
+      for (auto& pattern : patterns) {
+        if (fnmatch(pattern.c_str(), key.c_str(), 0) == 0) return true;
+      }
+      return false;
+    };
+    ofp::KeyIndex::Entries entries;
+    if (!readCompressedEntriesAs(fileFormat, file_to_parse_name, compression,
+                                 wanted, entries)) {
+      std::cerr << APP_NAME "Failed to read file: '" << file_to_parse_name
+                << "'" << std::endl;
+      return readFailedCode;
+    }
+    if (mode == ModifyKeysMode::publish) {
+      return publishEntries(sharedTableName, entries, statsEnabled);
+    }
+    if (mode == ModifyKeysMode::codegen) {
+      ofp::generateHeader(std::cout, entries, codegenNamespace,
+                          file_to_parse_name);
+      return 0;
+    }
+    if (mode == ModifyKeysMode::render) {
+      return renderTemplates(templateFiles, entries, statsEnabled);
+    }
+    if (mode == ModifyKeysMode::exportShell || mode == ModifyKeysMode::exec) {
+      return exportEntries(entries, keysToReadOrDelete, execArgv);
+    }
+    std::map<std::string, std::string> keyValueMap(entries.begin(),
+                                                   entries.end());
+    printValues(keysToReadOrDelete, keyValueMap, entries, sortedEnabled,
+                verboseEnabled);
+    return 0;
+  }
+
+  // sort in runs of the memory budget, the file is never loaded as a whole
+  if (mode == ModifyKeysMode::normalize) {
+    std::cerr << APP_NAME "Mode: NORMALIZE" << std::endl;
+    ofp::NormalizeStats stats;
+    if (!ofp::normalizeFile(file_to_parse_name, compression, memoryBudget,
+                            &stats)) {
+      std::cerr << APP_NAME "Failed to normalize file: '" << file_to_parse_name
+                << "'" << std::endl;
+      return -1;
+    }
+    if (statsEnabled) {
+      if (stats.unchanged) {
+        std::cerr << APP_NAME "File unchanged, nothing written" << std::endl;
+      }
+      std::cerr << APP_NAME "Normalized: " << stats.input_bytes << " to "
+                << stats.output_bytes << " bytes, " << stats.records
+                << " records to " << stats.keys << " keys" << std::endl
+                << APP_NAME "Sorted runs: " << stats.runs << ", "
+                << std::fixed << std::setprecision(1)
+                << stats.throughput() / 1e6 << " MB/s" << std::endl;
+    }
+    return 0;
+  }
 
-  if (!input_file.is_open()) {
+  // work on the file, a compressed one is edited decompressed. A single
+  // file is mapped with either engine, io_uring would only add a copy of
+  // it. Writers lock the file before reading it, until it has been replaced.
+  ofp::FileLock lock;
+  if (!diffEnabled &&
+      (mode == ModifyKeysMode::write || mode == ModifyKeysMode::remove ||
+       mode == ModifyKeysMode::compact) &&
+      !lock.lock(file_to_parse_name)) {
     std::cerr << APP_NAME "Failed to open file: '" << file_to_parse_name << "'"
               << std::endl;
+    return -1;
+  }
+  ofp::MappedFile input_file;
+  std::string content;
+  bool opened = false;
+  if (compression != ofp::Compression::none) {
+    opened = ofp::decompressFile(file_to_parse_name, compression, content);
   } else {
-    if (mode == ModifyKeysMode::read) {
-      std::cerr << APP_NAME "Mode: READ" << std::endl;
-      std::map<std::string, std::string> keyValueMap;
-      while (std::getline(input_file, input_line)) {
-        if (input_line[0] == '#') continue;  // ignore commented lines
+    opened = input_file.open(file_to_parse_name);
+  }
+
+  if (!opened) {
+    std::cerr << APP_NAME "Failed to open file: '" << file_to_parse_name << "'"
+              << std::endl;
+    return readFailedCode;
+  } else {
+    std::string_view view = input_file.view().data()
+                                 ? input_file.view()
+                                 : std::string_view(content);
+    if (mode == ModifyKeysMode::exists) {
+      std::cerr << APP_NAME "Mode: EXISTS" << std::endl;
+      std::vector<bool> present;
+      std::size_t scanned = 0;
+      if (ofp::isSorted(view)) {
+        // binary search, without splitting the file into lines
+        ofp::SortedFile sortedFile(view);
         for (auto& key : keysToReadOrDelete) {
-          std::size_t eq_pos = lineHasKey(input_line, key);
-          if (eq_pos != std::string::npos) {
-            keyValueMap.emplace(
-                key, trim(input_line.substr(eq_pos + 1, input_line.size())));
-          }
+          present.push_back(sortedFile.find(key).has_value());
         }
+      } else {
+        ofp::findPresentKeys(view, keysToReadOrDelete, present, &scanned);
+      }
+      if (statsEnabled) {
+        std::cerr << APP_NAME "Scanned: " << scanned << " of " << view.size()
+                  << " bytes" << std::endl;
       }
+      return presenceExitCode(keysToReadOrDelete, present, verboseEnabled);
+    }
 
+    // the version is a hash of the bytes, the lines are not needed
+    if (mode == ModifyKeysMode::hash) {
+      std::cerr << APP_NAME "Mode: HASH" << std::endl;
+      std::cout << std::hex << std::setw(16) << std::setfill('0')
+                << ofp::contentVersion(view) << std::endl;
+      return 0;
+    }
+
+    bool hasPatterns = std::any_of(keysToReadOrDelete.begin(),
+                                   keysToReadOrDelete.end(),
+                                   [](const std::string& key) {
+                                     return ofp::isPattern(key);
+                                   });
+    if (mode == ModifyKeysMode::read && !hasPatterns &&
+        fileFormat == ofp::FileFormat::equals && ofp::isSorted(view)) {
+      // binary search, without splitting the file into lines
+      std::cerr << APP_NAME "Mode: READ (sorted)" << std::endl;
+      ofp::SortedFile sortedFile(view);
       for (auto& key : keysToReadOrDelete) {
         if (verboseEnabled) std::cerr << key << "=";
-        std::cout << keyValueMap[key] << std::endl;
+        std::cout << sortedFile.find(key).value_or("") << std::endl;
       }
-
-      input_file.close();
-    } else if (mode == ModifyKeysMode::write ||
-               mode == ModifyKeysMode::remove) {
-      while (std::getline(input_file, input_line)) {
-        all_file_lines.emplace_back(std::move(input_line));
+      if (statsEnabled) {
+        std::cerr << APP_NAME "Journal length: " << sortedFile.journalLength()
+                  << " records" << std::endl;
       }
-      input_file.close();
+      return 0;
+    }
 
-      // open file early, to avoid unnecessary computations
-      std::ofstream output_file(file_to_parse_name);
-      if (!output_file.is_open()) {
-        std::cerr << APP_NAME "Failed to open output file: "
-                  << file_to_parse_name << std::endl;
-        return -1;
+    ofp::Document document(view);
+    const std::vector<std::string_view>& all_file_lines = document.lines();
+
+    if (mode == ModifyKeysMode::read &&
+        fileFormat != ofp::FileFormat::equals) {
+      std::cerr << APP_NAME "Mode: READ" << std::endl;
+      ofp::KeyIndex::Entries entries =
+          readEntriesAs(fileFormat, all_file_lines);
+      std::map<std::string, std::string> keyValueMap(entries.begin(),
+                                                     entries.end());
+      printValues(keysToReadOrDelete, keyValueMap, entries, sortedEnabled,
+                  verboseEnabled);
+    } else if (mode == ModifyKeysMode::read) {
+      std::cerr << APP_NAME "Mode: READ" << std::endl;
+      std::size_t journalBegin = ofp::journalStart(all_file_lines);
+      // a lookup scans the section of the key, many keys are answered by
+      // parsing the whole file once instead
+      bool manyKeys = keysToReadOrDelete.size() > kLookupKeyLimit;
+      ofp::KeyIndex::Entries entries;
+      if (hasPatterns || manyKeys) entries = ofp::readEntries(all_file_lines);
+      std::map<std::string, std::string> keyValueMap;
+      if (manyKeys) {
+        keyValueMap.insert(entries.begin(), entries.end());
+      } else {
+        ofp::JournalState journal =
+            ofp::readJournal(all_file_lines, journalBegin);
+        SectionIndex index(all_file_lines);
+        for (auto& key : keysToReadOrDelete) {
+          if (ofp::isPattern(key)) continue;
+          auto value = ofp::readValue(all_file_lines, index, journal, key);
+          if (value) keyValueMap.emplace(key, std::move(*value));
+        }
       }
 
+      printValues(keysToReadOrDelete, keyValueMap, entries, sortedEnabled,
+                  verboseEnabled);
+      if (statsEnabled) {
+        std::cerr << APP_NAME "Journal length: "
+                  << all_file_lines.size() - journalBegin << " records"
+                  << std::endl;
+      }
+    } else if (mode == ModifyKeysMode::exportShell ||
+               mode == ModifyKeysMode::exec) {
+      std::cerr << APP_NAME "Mode: "
+                << (mode == ModifyKeysMode::exec ? "EXEC" : "EXPORT")
+                << std::endl;
+      return exportEntries(readEntriesAs(fileFormat, all_file_lines),
+                           keysToReadOrDelete, execArgv);
+    } else if (mode == ModifyKeysMode::render) {
+      std::cerr << APP_NAME "Mode: RENDER" << std::endl;
+      return renderTemplates(templateFiles,
+                             readEntriesAs(fileFormat, all_file_lines),
+                             statsEnabled);
+    } else if (mode == ModifyKeysMode::codegen) {
+      std::cerr << APP_NAME "Mode: CODEGEN" << std::endl;
+      ofp::generateHeader(std::cout,
+                          readEntriesAs(fileFormat, all_file_lines),
+                          codegenNamespace, file_to_parse_name);
+    } else if (mode == ModifyKeysMode::publish) {
+      std::cerr << APP_NAME "Mode: PUBLISH" << std::endl;
+      return publishEntries(sharedTableName,
+                            readEntriesAs(fileFormat, all_file_lines),
+                            statsEnabled);
+    } else {
+      auto compactionStart = std::chrono::steady_clock::now();
       if (mode == ModifyKeysMode::write) {
         std::cerr << APP_NAME "Mode: WRITE" << std::endl;
-        // replace values of existing keys
-        for (auto& line : all_file_lines) {
-          for (auto it = keysToWrite.begin(); it != keysToWrite.end();) {
-            if (lineHasKey(line, it->first) != std::string::npos) {
-              line = it->first + "=" + it->second;
-              it = keysToWrite.erase(it);
-            } else {
-              ++it;
-            }
-          }
-        }
-        // add all new key-value pairs
-        for (auto& keyValuePair : keysToWrite) {
-          all_file_lines.emplace_back(keyValuePair.first + "=" +
-                                      keyValuePair.second);
-        }
       } else if (mode == ModifyKeysMode::remove) {
         std::cerr << APP_NAME "Mode: DELETE" << std::endl;
+      } else {
+        std::cerr << APP_NAME "Mode: COMPACT" << std::endl;
+      }
+      std::size_t journalLength =
+          ofp::compactJournal(document, keysToWrite, keysToReadOrDelete);
 
-        // only us unique values to reduce loop time
-        keysToReadOrDelete.unique(
-            [](std::string& a, std::string& b) { return (a == b); });
-        // remove all occurrences of the key-value pair
-        for (auto it = keysToReadOrDelete.begin();
-             it != keysToReadOrDelete.end(); ++it) {
-          for (auto line = all_file_lines.begin();
-               line != all_file_lines.end();) {
-            if (lineHasKey((*line), (*it)) != std::string::npos) {
-              line = all_file_lines.erase(line);
-            } else {
-              ++line;
-            }
-          }
+      // ship the edits instead of the file
+      if (diffEnabled) {
+        std::string changeset =
+            ofp::makeChangeset(document, file_to_parse_name);
+        std::cout << changeset << std::flush;
+        if (statsEnabled) {
+          std::cerr << APP_NAME "Changeset: " << changeset.size()
+                    << " bytes for a file of " << document.original().size()
+                    << " bytes" << std::endl;
         }
+        return 0;
       }
-      // write out the file
-      for (auto& line : all_file_lines) {
-        output_file << line << std::endl;
+
+      // leave the file and its mtime alone if nothing changed
+      if (!document.modified()) {
+        if (statsEnabled) {
+          std::cerr << APP_NAME "File unchanged, nothing written" << std::endl;
+        }
+        return 0;
+      }
+
+      // write out the file, unchanged parts straight from the mapping
+      bool replaced =
+          compression == ofp::Compression::none
+              ? ofp::replaceFile(file_to_parse_name, document, ioEngine)
+              : ofp::replaceFile(file_to_parse_name, document, compression);
+      if (!replaced) {
+        std::cerr << APP_NAME "Failed to open output file: "
+                  << file_to_parse_name << std::endl;
+        return -1;
+      }
+      auto compactionTime = std::chrono::steady_clock::now() - compactionStart;
+
+      if (statsEnabled) {
+        std::cerr << APP_NAME "Journal length: " << journalLength
+                  << " records compacted" << std::endl;
+        if (mode == ModifyKeysMode::compact) {
+          std::cerr << APP_NAME "Compaction time: "
+                    << std::chrono::duration_cast<std::chrono::microseconds>(
+                           compactionTime)
+                           .count()
+                    << " us" << std::endl;
+        }
       }
-      output_file.close();
     }
   }
   return 0;
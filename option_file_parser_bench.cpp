@@ -0,0 +1,298 @@
+/**
+ * @file option_file_parser_bench.cpp
+ * @author Herwig Letofsky
+ * @brief compares READ on a compressed option file streamed through the
+ * parser with decompressing the whole file first and parsing it afterwards,
+ * and the blocking I/O engine with io_uring for reading many files and for
+ * writing a file, and replays the performance regression corpus of the fuzz
+ * target, and applies many writes to a large file. Build and run with:
+ *   g++ -std=c++17 -O2 option_file_parser_bench.cpp -o bench -lz -pthread
+ *   ./bench options.conf.gz server.port db.url
+ *   ./bench --io service-a.conf service-b.conf
+ *   ./bench --corpus
+ *   ./bench --corpus slow-1234ns-0123456789abcdef
+ *   ./bench --writes 1000000 10000
+ *
+ * --corpus without inputs replays ofp::fuzz::seedInputs(), the regression
+ * corpus checked in with option_file_parser_fuzz.hpp, inputs given as files
+ * are replayed instead, e.g. the slow ones the fuzzer saved.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "option_compressed.hpp"
+#include "option_document.hpp"
+#include "option_file.hpp"
+#include "option_file_parser_fuzz.hpp"
+#include "option_io.hpp"
+#include "option_journal.hpp"
+#include "option_key_list.hpp"
+
+namespace {
+
+constexpr int kIterations = 5;
+
+struct Result {
+  double seconds = 0;       // best of all iterations
+  std::size_t memory = 0;   // bytes of buffers holding file content
+  std::size_t found = 0;   // keys or entries
+};
+
+template <typename Fn>
+Result measure(Fn fn) {
+  Result result;
+  result.seconds = 1e9;
+  for (int i = 0; i < kIterations; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    fn(result);
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    result.seconds = std::min(result.seconds, time.count());
+  }
+  return result;
+}
+
+void report(const char* name, const Result& result, std::size_t bytes) {
+  std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(9)
+            << bytes / result.seconds / 1e6 << " MB/s";
+  if (result.memory) {
+    std::cout << std::setw(10) << result.memory / 1024 << " KiB buffered";
+  }
+  if (result.found) std::cout << ", " << result.found << " found";
+  std::cout << std::endl;
+}
+
+// number of key-value lines, as cheap stand-in for parsing
+std::size_t countEntries(std::string_view content) {
+  std::size_t entries = 0;
+  std::string_view key, value;
+  ofp::forEachLine(content, [&](std::string_view line) {
+    if (ofp::splitLine(line, key, value)) ++entries;
+  });
+  return entries;
+}
+
+int benchIo(const std::vector<std::string>& paths) {
+  std::size_t bytes = 0;
+  ofp::readFiles(paths, ofp::IoEngine::blocking,
+                 [&bytes](std::size_t, bool, std::string_view content) {
+                   bytes += content.size();
+                 });
+  std::cout << paths.size() << " files, " << bytes
+            << " bytes, best of " << kIterations << " runs" << std::endl;
+  for (auto engine : {ofp::IoEngine::blocking, ofp::IoEngine::uring}) {
+    Result parsed = measure([&](Result& result) {
+      result.found = 0;
+      ofp::readFiles(paths, engine,
+                     [&result](std::size_t, bool, std::string_view content) {
+                       result.found += countEntries(content);
+                     });
+    });
+    report(engine == ofp::IoEngine::uring ? "read and parse, uring"
+                                          : "read and parse, blocking",
+           parsed, bytes);
+  }
+
+  // rewrite a copy of the first file, which includes its fsync()
+  std::string content;
+  ofp::readFiles({paths.front()}, ofp::IoEngine::blocking,
+                 [&content](std::size_t, bool, std::string_view data) {
+                   content.assign(data.data(), data.size());
+                 });
+  std::string copy = paths.front() + ".bench";
+  ofp::Document document(content);
+  if (!document.lines().empty()) document.replaceLine(0, "bench=1");
+  for (auto engine : {ofp::IoEngine::blocking, ofp::IoEngine::uring}) {
+    Result result = measure([&](Result&) {
+      ofp::replaceFile(copy.c_str(), document, engine);
+    });
+    report(engine == ofp::IoEngine::uring ? "write and sync, uring"
+                                          : "write and sync, blocking",
+           result, content.size());
+  }
+  ::unlink(copy.c_str());
+  return 0;
+}
+
+// the corpus input repeated this often has to take at most twice as long
+// per byte as the input itself, or its cost grows faster than linear
+constexpr int kRepeat = 8;
+
+int benchCorpus(const std::vector<std::string>& paths) {
+  // by name, the checked-in corpus if no files are given
+  std::vector<std::pair<std::string, std::string>> inputs;
+  if (paths.empty()) inputs = ofp::fuzz::seedInputs();
+  for (auto& path : paths) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      std::cerr << "failed to read: " << path << std::endl;
+      return -1;
+    }
+    inputs.emplace_back(path.substr(path.rfind('/') + 1),
+                        std::string((std::istreambuf_iterator<char>(file)),
+                                    std::istreambuf_iterator<char>()));
+  }
+  std::cout << inputs.size() << " inputs, each alone and repeated " << kRepeat
+            << " times, best of " << kIterations << " runs" << std::endl;
+  int superlinear = 0;
+  for (auto& named : inputs) {
+    const std::string& name = named.first;
+    const std::string& input = named.second;
+    std::string repeated;
+    for (int i = 0; i < kRepeat; ++i) repeated += input;
+
+    Result once = measure([&input](Result& result) {
+      result.found = ofp::fuzz::parseAndEdit(input);
+    });
+    Result many = measure([&repeated](Result& result) {
+      result.found = ofp::fuzz::parseAndEdit(repeated);
+    });
+    report(name.c_str(), once, input.size());
+    report(("  x" + std::to_string(kRepeat)).c_str(), many, repeated.size());
+    if (many.seconds / repeated.size() > 2 * once.seconds / input.size()) {
+      std::cout << "  superlinear: " << name << std::endl;
+      ++superlinear;
+    }
+  }
+  return superlinear ? 1 : 0;
+}
+
+int benchCompressed(const char* path,
+                    const std::vector<std::string>& keys) {
+  ofp::Compression compression = ofp::compressionOf(path);
+  if (compression == ofp::Compression::none ||
+      !ofp::compressionSupported(compression)) {
+    std::cerr << "unsupported compression: " << path << std::endl;
+    return -1;
+  }
+  std::set<std::string> wanted(keys.begin(), keys.end());
+
+  std::string content;
+  if (!ofp::decompressFile(path, compression, content)) {
+    std::cerr << "failed to read: " << path << std::endl;
+    return -1;
+  }
+  std::size_t bytes = content.size();
+  content = std::string();
+
+  Result streamed = measure([&](Result& result) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    ofp::readCompressedEntries(
+        path, compression,
+        [&wanted](const std::string& key) { return wanted.count(key) > 0; },
+        entries);
+    result.found = entries.size();
+    result.memory = 3 * ofp::DecompressingReader::kChunkSize;
+  });
+
+  Result materialized = measure([&](Result& result) {
+    std::string decompressed;
+    ofp::decompressFile(path, compression, decompressed);
+    std::vector<std::string_view> lines = ofp::splitLines(decompressed);
+    ofp::SectionIndex index(lines);
+    ofp::JournalState journal =
+        ofp::readJournal(lines, ofp::journalStart(lines));
+    result.found = 0;
+    for (auto& key : keys) {
+      if (ofp::readValue(lines, index, journal, key)) ++result.found;
+    }
+    result.memory = decompressed.capacity() +
+                    lines.capacity() * sizeof(std::string_view);
+  });
+
+  std::cout << path << ": " << bytes << " bytes decompressed, best of "
+            << kIterations << " runs" << std::endl;
+  report("streaming", streamed, bytes);
+  report("decompress, then parse", materialized, bytes);
+  return 0;
+}
+
+// a quarter of the writes repeats an earlier key, half of the rest sets
+// existing keys and the other half adds new ones
+int benchWrites(std::size_t lineCount, std::size_t writeCount) {
+  std::string content;
+  for (std::size_t i = 0; i < lineCount; ++i) {
+    content += "key" + std::to_string(i) + "=value" + std::to_string(i) + "\n";
+  }
+  std::vector<std::string> arguments;
+  std::size_t argumentBytes = 0;
+  std::set<std::size_t> added;
+  for (std::size_t i = 0; i < writeCount; ++i) {
+    std::size_t n = i % 4 == 3 ? i - 3 : i;
+    std::size_t key = n % 2 ? lineCount + n : n * lineCount / writeCount;
+    arguments.push_back("key" + std::to_string(key) + "=new" +
+                        std::to_string(i));
+    argumentBytes += arguments.back().size();
+    if (key >= lineCount) added.insert(key);
+  }
+  std::cout << lineCount << " lines, " << content.size() << " bytes, "
+            << writeCount << " writes, best of " << kIterations << " runs"
+            << std::endl;
+
+  std::vector<std::pair<std::string, std::string>> writes;
+  Result dedup = measure([&](Result& result) {
+    ofp::WriteList writeList;
+    for (auto& argument : arguments) {
+      std::string_view arg = argument;
+      std::size_t eq_pos = arg.find('=');
+      writeList.set(arg.substr(0, eq_pos), arg.substr(eq_pos + 1));
+    }
+    writes.assign(writeList.begin(), writeList.end());
+    result.found = writes.size();
+  });
+  Result apply = measure([&](Result& result) {
+    ofp::Document document(content);
+    ofp::editLines(document, writes, std::vector<std::string>());
+    result.found = 0;
+    document.forEachPiece([&result](std::string_view piece) {
+      result.found += std::count(piece.begin(), piece.end(), '\n');
+    });
+  });
+  report("deduplicate arguments", dedup, argumentBytes);
+  report("apply in one pass", apply, content.size());
+  if (apply.found != lineCount + added.size()) {
+    std::cout << "  expected " << lineCount + added.size() << " lines"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc >= 2 && std::string_view(argv[1]) == "--corpus") {
+    return benchCorpus(std::vector<std::string>(argv + 2, argv + argc));
+  }
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " <file.gz|file.zst> <key>...\n"
+              << "       " << argv[0] << " --io <file>...\n"
+              << "       " << argv[0] << " --corpus [<input>...]\n"
+              << "       " << argv[0] << " --writes <lines> <writes>"
+              << std::endl;
+    return -1;
+  }
+  if (std::string_view(argv[1]) == "--io") {
+    return benchIo(std::vector<std::string>(argv + 2, argv + argc));
+  }
+  if (std::string_view(argv[1]) == "--writes" && argc == 4) {
+    return benchWrites(std::strtoull(argv[2], nullptr, 10),
+                       std::strtoull(argv[3], nullptr, 10));
+  }
+  return benchCompressed(argv[1],
+                         std::vector<std::string>(argv + 2, argv + argc));
+}
@@ -0,0 +1,104 @@
+/**
+ * @file option_file_parser_fuzz.cpp
+ * @author Herwig Letofsky
+ * @brief libFuzzer target for the line parser and the READ, WRITE and
+ * DELETE transformations. Besides crashes it hunts for slow inputs: the time
+ * of every input is measured and an input which is slower per byte than all
+ * before is saved to $OFP_FUZZ_SLOW_DIR, if set. Only the in-memory
+ * workload is timed, the edits on files are checked after it.
+ *
+ * The performance regression corpus is ofp::fuzz::seedInputs(), checked in
+ * with option_file_parser_fuzz.hpp. It seeds the fuzzer, and the benchmark
+ * replays it. A saved slow input which the benchmark shows to be slow, or
+ * superlinear, goes there with a comment on what it stresses. Build and
+ * run with:
+ *   g++ -std=c++17 -O2 -DOFP_FUZZ_MAIN option_file_parser_fuzz.cpp \\
+ *       -o fuzz-seed -lz -pthread && ./fuzz-seed --seed /tmp/corpus
+ *   clang++ -std=c++17 -O2 -g -fsanitize=fuzzer,address \\
+ *       option_file_parser_fuzz.cpp -o fuzz -lz -pthread
+ *   OFP_FUZZ_SLOW_DIR=/tmp/slow ./fuzz -max_len=65536 /tmp/corpus
+ *   ./bench --corpus /tmp/slow/slow-[0-9]*
+ *
+ * Without libFuzzer, define OFP_FUZZ_MAIN to get a main() which runs the
+ * inputs given as files once, or writes the seed corpus into a directory
+ * with --seed.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include "option_file_parser_fuzz.hpp"
+#include "option_hash.hpp"
+
+namespace {
+
+// shorter inputs are dominated by constant costs and timer resolution
+constexpr std::size_t kMinSlowSize = 256;
+
+// slowest input so far, in nanoseconds per byte
+double slowest = 0;
+
+void saveSlowInput(std::string_view input, double nsPerByte) {
+  const char* dir = std::getenv("OFP_FUZZ_SLOW_DIR");
+  if (!dir) return;
+  char name[64];
+  std::snprintf(name, sizeof(name), "/slow-%.0fns-%016llx", nsPerByte,
+                static_cast<unsigned long long>(ofp::contentHash(input)));
+  std::ofstream file(std::string(dir) + name, std::ios::binary);
+  file.write(input.data(), input.size());
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data,
+                                      std::size_t size) {
+  std::string_view input(reinterpret_cast<const char*>(data), size);
+  auto start = std::chrono::steady_clock::now();
+  ofp::fuzz::parseAndEdit(input);
+  std::chrono::duration<double, std::nano> time =
+      std::chrono::steady_clock::now() - start;
+  if (size >= kMinSlowSize && time.count() / size > slowest) {
+    slowest = time.count() / size;
+    saveSlowInput(input, slowest);
+  }
+  ofp::fuzz::fileEdits(input);
+  return 0;
+}
+
+#ifdef OFP_FUZZ_MAIN
+int main(int argc, char* argv[]) {
+  if (argc == 3 && std::string_view(argv[1]) == "--seed") {
+    for (auto& seed : ofp::fuzz::seedInputs()) {
+      std::string path = std::string(argv[2]) + "/" + seed.first;
+      std::ofstream file(path, std::ios::binary);
+      if (!file.write(seed.second.data(), seed.second.size())) {
+        std::cerr << "failed to write: " << path << std::endl;
+        return -1;
+      }
+    }
+    return 0;
+  }
+  for (int i = 1; i < argc; ++i) {
+    std::ifstream file(argv[i], std::ios::binary);
+    if (!file) {
+      std::cerr << "failed to read: " << argv[i] << std::endl;
+      return -1;
+    }
+    std::string input((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(input.data()),
+                           input.size());
+  }
+  return 0;
+}
+#endif
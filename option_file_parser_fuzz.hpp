@@ -0,0 +1,289 @@
+/**
+ * @file option_file_parser_fuzz.hpp
+ * @author Herwig Letofsky
+ * @brief the parser workload shared by the fuzz target and the corpus
+ * replay of the benchmark: parse the input as option file, READ, WRITE and
+ * DELETE keys taken from the input itself and check that the result reads
+ * back as expected. Besides the in-memory workload, fileEdits() runs the
+ * edits which work on files, streamEdits() and normalizeFile(), and checks
+ * their output with SortedFile. seedInputs() is the performance regression
+ * corpus.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_FILE_PARSER_FUZZ_HPP
+#define OPTION_FILE_PARSER_FUZZ_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+#include "option_external_sort.hpp"
+#include "option_file.hpp"
+#include "option_journal.hpp"
+#include "option_sorted.hpp"
+#include "option_stream.hpp"
+
+namespace ofp {
+namespace fuzz {
+
+// longest key taken from the input, keeps the workload linear in its size
+constexpr std::size_t kMaxKeySize = 64;
+
+/**
+ * @return a key made of the word characters and inner dots of text, which
+ * any file has to read back after writing it
+ */
+inline std::string keyOf(std::string_view text) {
+  std::string key;
+  for (char c : text.substr(0, kMaxKeySize)) {
+    bool word = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9') || c == '_' || c == '-';
+    if (word || (c == '.' && !key.empty() && key.back() != '.')) key += c;
+  }
+  while (!key.empty() && key.back() == '.') key.pop_back();
+  return key.empty() ? std::string("fuzz.key") : key;
+}
+
+/**
+ * @brief runs READ, WRITE and DELETE on the input, aborts if WRITE or DELETE
+ * do not read back
+ *
+ * @return number of key-value pairs of the input, to keep the work alive
+ */
+inline std::size_t parseAndEdit(std::string_view input) {
+  std::vector<std::string_view> lines = splitLines(input);
+  std::string written = keyOf(lines.empty() ? input : lines.front());
+  std::string deleted;
+  forEachEntry(lines, [&](std::string_view section, std::string_view key,
+                          std::string_view, std::size_t) {
+    if (deleted.empty()) deleted = qualifiedKey(section, key);
+  });
+  if (deleted == written || keyOf(deleted) != deleted) deleted.clear();
+
+  // READ
+  SectionIndex index(lines);
+  JournalState journal = readJournal(lines, journalStart(lines));
+  std::size_t found = readEntries(lines).size();
+  for (auto& line : lines) {
+    if (lineHasKey(line, written) != std::string::npos) ++found;
+  }
+  std::optional<std::string> written_value =
+      readValue(lines, index, journal, written);
+  if (written_value) ++found;
+  std::vector<bool> present;
+  findPresentKeys(input, std::vector<std::string>{written}, present);
+  if (present.front() != written_value.has_value()) std::abort();
+
+  // WRITE and DELETE, then read the result back
+  Document document(input);
+  std::vector<std::pair<std::string, std::string>> writes{{written, "fuzz"}};
+  std::vector<std::string> deletes;
+  if (!deleted.empty()) deletes.push_back(deleted);
+  compactJournal(document, writes, deletes);
+  std::string output;
+  document.forEachPiece([&output](std::string_view piece) {
+    output.append(piece.data(), piece.size());
+  });
+  if (!document.modified() && output != input) std::abort();
+
+  // journal records may hold keys no key-value line can hold, e.g. one
+  // which turns the line into a section header, those are folded verbatim
+  for (auto& record : journal) {
+    if (keyOf(record.first) != record.first) return found;
+  }
+
+  std::vector<std::string_view> output_lines = splitLines(output);
+  SectionIndex output_index(output_lines);
+  JournalState output_journal;
+  if (readValue(output_lines, output_index, output_journal, written) !=
+      std::optional<std::string>("fuzz")) {
+    std::abort();
+  }
+  if (!deleted.empty() &&
+      readValue(output_lines, output_index, output_journal, deleted)) {
+    std::abort();
+  }
+  return found;
+}
+
+namespace detail {
+
+// scratch file of the process for the edits which work on files
+inline const std::string& scratchPath(int which) {
+  static std::string paths[2];
+  std::string& path = paths[which];
+  if (path.empty()) {
+    const char* dir = std::getenv("TMPDIR");
+    path = std::string(dir ? dir : "/tmp") + "/ofp-fuzz-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0) ::close(fd);
+    std::atexit([] {
+      for (auto& scratch : paths) {
+        if (!scratch.empty()) ::unlink(scratch.c_str());
+      }
+    });
+  }
+  return path;
+}
+
+inline bool writeFile(const std::string& path, std::string_view content) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) return false;
+  bool ok = ofp::detail::writeAll(fd, content.data(), content.size());
+  return ::close(fd) == 0 && ok;
+}
+
+inline std::string readFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+}  // namespace detail
+
+/**
+ * @brief runs the edits which work on files on the input: streamEdits()
+ * with the WRITE and DELETE of parseAndEdit(), normalizeFile() and READ on
+ * the sorted result. Aborts if they do not read back as READ on the input.
+ */
+inline void fileEdits(std::string_view input) {
+  std::vector<std::string_view> lines = splitLines(input);
+  std::string written = keyOf(lines.empty() ? input : lines.front());
+  std::string deleted;
+  forEachEntry(lines, [&](std::string_view section, std::string_view key,
+                          std::string_view, std::size_t) {
+    if (deleted.empty()) deleted = qualifiedKey(section, key);
+  });
+  if (deleted == written || keyOf(deleted) != deleted) deleted.clear();
+  SectionIndex index(lines);
+  JournalState journal = readJournal(lines, journalStart(lines));
+  for (auto& record : journal) {
+    if (keyOf(record.first) != record.first) return;  // see parseAndEdit()
+  }
+
+  const std::string& in_path = detail::scratchPath(0);
+  const std::string& out_path = detail::scratchPath(1);
+  if (!detail::writeFile(in_path, input)) std::abort();
+
+  // WRITE and DELETE as filter
+  int in = ::open(in_path.c_str(), O_RDONLY);
+  int out = ::open(out_path.c_str(), O_WRONLY | O_TRUNC);
+  std::vector<std::pair<std::string, std::string>> writes{{written, "fuzz"}};
+  std::vector<std::string> deletes;
+  if (!deleted.empty()) deletes.push_back(deleted);
+  bool streamed = in >= 0 && out >= 0 &&
+                  streamEdits(in, out, writes, deletes);
+  if (in >= 0) ::close(in);
+  if (out >= 0) ::close(out);
+  if (!streamed) std::abort();
+  std::string output = detail::readFile(out_path);
+  std::vector<std::string_view> output_lines = splitLines(output);
+  SectionIndex output_index(output_lines);
+  JournalState output_journal =
+      readJournal(output_lines, journalStart(output_lines));
+  if (readValue(output_lines, output_index, output_journal, written) !=
+      std::optional<std::string>("fuzz")) {
+    std::abort();
+  }
+  if (!deleted.empty() &&
+      readValue(output_lines, output_index, output_journal, deleted)) {
+    std::abort();
+  }
+
+  // normalize, READ on the sorted file has to find what READ on the input
+  // finds
+  if (!normalizeFile(in_path.c_str(), Compression::none, 0)) std::abort();
+  std::string normalized = detail::readFile(in_path);
+  if (!isSorted(normalized)) std::abort();
+  SortedFile sorted(normalized);
+  for (auto& key : {written, deleted}) {
+    if (key.empty()) continue;
+    if (sorted.find(key) != readValue(lines, index, journal, key)) {
+      std::abort();
+    }
+  }
+}
+
+// size of the regression inputs, the -max_len of the fuzzer
+constexpr std::size_t kSeedSize = 64 * 1024;
+
+/**
+ * @brief the performance regression corpus: inputs of about kSeedSize bytes
+ * with the shapes which were slow, by name. It seeds the fuzzer and the
+ * benchmark replays it. A slow input the fuzzer saves goes here, reduced to
+ * the pattern which makes it slow and with a comment naming what it
+ * stresses.
+ */
+inline std::vector<std::pair<std::string, std::string>> seedInputs() {
+  auto repeat = [](std::string_view text, std::size_t count) {
+    std::string result;
+    result.reserve(text.size() * count);
+    for (std::size_t i = 0; i < count; ++i) result.append(text);
+    return result;
+  };
+  std::vector<std::pair<std::string, std::string>> seeds;
+  // a key followed by nothing but empty lines, which were indexed at [0]
+  seeds.emplace_back("empty-lines", "a.b" + repeat("\n", kSeedSize + 1));
+  // lines with an empty key and value, splitLine() rejects each of them
+  seeds.emplace_back("equals-lines", repeat("=\n", kSeedSize / 2));
+  // a journal of sets and deletes, each record replaces an earlier one
+  std::string journal = "x=1\n";
+  for (std::size_t i = 0; i < kSeedSize / 24; ++i) {
+    journal += "#@set k" + std::to_string(i) + "=v\n#@del k" +
+               std::to_string(i / 2) + "\n";
+  }
+  seeds.emplace_back("long-journal", std::move(journal));
+  // one key as long as the input, trimmed and compared per lookup
+  seeds.emplace_back("long-line", repeat("k", kSeedSize) + "=v\n");
+  // one value as long as the input, copied on READ and replaced on WRITE
+  seeds.emplace_back("long-value", "key=" + repeat("v", kSeedSize) + "\n");
+  // a section per key, the first level of SectionIndex
+  std::string sections;
+  for (std::size_t i = 0; i < kSeedSize / 10; ++i) {
+    sections += "[s" + std::to_string(i) + "]\nk=v\n";
+  }
+  seeds.emplace_back("many-sections", std::move(sections));
+  // sections nested 1 to 32 deep, a dotted key is looked up in each prefix
+  std::string nested = repeat("a.", 31) + "b\n";
+  std::string section;
+  for (std::size_t i = 0; i < kSeedSize / 40; ++i) {
+    section = i % 32 == 0 ? "a" : section + ".a";
+    nested += "[" + section + "]\n\n";
+  }
+  seeds.emplace_back("nested-sections", std::move(nested));
+  // a single line of '=', its key is empty
+  seeds.emplace_back("only-equals", repeat("=", kSeedSize));
+  // the same key on every line, READ takes the first, DELETE removes all
+  seeds.emplace_back("repeated-key", repeat("k=v\n", kSeedSize / 4));
+  // a single line of whitespace, trimmed from both ends
+  seeds.emplace_back("whitespace", repeat(" \t", kSeedSize / 2));
+  // lines of whitespace and a CR, blank for every parser
+  seeds.emplace_back("whitespace-lines", repeat(" \t\r\n", kSeedSize / 4));
+  // found by the fuzzer: a file marked sorted with indented, repeated keys
+  // and blank values, the sorted insert of WRITE and normalizeFile()
+  seeds.emplace_back("sorted-short-lines",
+                     std::string(kSortedMarker) + "\n" +
+                         repeat("\tk=v\nb= \n\t\tab= \n", kSeedSize / 16));
+  // found by the fuzzer: short keys with wildcard characters and blank
+  // values between blank lines, a key-value line for every few bytes
+  seeds.emplace_back("wildcard-keys",
+                     repeat("*kb= \n\nk*b= \n", kSeedSize / 14));
+  return seeds;
+}
+
+}  // namespace fuzz
+}  // namespace ofp
+
+#endif  // OPTION_FILE_PARSER_FUZZ_HPP
@@ -0,0 +1,157 @@
+/**
+ * @file option_hash.hpp
+ * @author Herwig Letofsky
+ * @brief XXH64 content hash for file versions. hashKey() is fine for short
+ * keys, but hashing a whole file byte by byte with FNV-1a is bound by the
+ * latency of one multiplication per byte. XXH64 consumes 32 bytes per round
+ * in four independent lanes. ContentHash takes the content in pieces of any
+ * size, so an edited Document is hashed without being assembled:
+ *
+ *   ofp::ContentHash hash;
+ *   document.forEachPiece([&hash](std::string_view piece) {
+ *     hash.update(piece);
+ *   });
+ *   std::uint64_t version = hash.digest();
+ *
+ * Follows the reference implementation, on little-endian hosts the digests
+ * are identical to the ones of xxhsum -H1.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_HASH_HPP
+#define OPTION_HASH_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace ofp {
+
+/**
+ * @brief incremental XXH64, update() may be called with pieces of any size
+ */
+class ContentHash {
+ public:
+  explicit ContentHash(std::uint64_t seed = 0)
+      : lanes_{seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+               seed - kPrime1},
+        seed_(seed) {}
+
+  void update(std::string_view data) {
+    const char* p = data.data();
+    std::size_t size = data.size();
+    length_ += size;
+    if (buffered_ + size < sizeof(buffer_)) {
+      std::memcpy(buffer_ + buffered_, p, size);
+      buffered_ += size;
+      return;
+    }
+    if (buffered_) {
+      std::size_t fill = sizeof(buffer_) - buffered_;
+      std::memcpy(buffer_ + buffered_, p, fill);
+      consume(buffer_);
+      p += fill;
+      size -= fill;
+      buffered_ = 0;
+    }
+    for (; size >= sizeof(buffer_); p += sizeof(buffer_)) {
+      consume(p);
+      size -= sizeof(buffer_);
+    }
+    std::memcpy(buffer_, p, size);
+    buffered_ = size;
+  }
+
+  /**
+   * @return hash of everything passed to update() so far
+   */
+  std::uint64_t digest() const {
+    std::uint64_t hash;
+    if (length_ >= sizeof(buffer_)) {
+      hash = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) + rotl(lanes_[2], 12) +
+             rotl(lanes_[3], 18);
+      for (std::uint64_t lane : lanes_) {
+        hash ^= round(0, lane);
+        hash = hash * kPrime1 + kPrime4;
+      }
+    } else {
+      hash = seed_ + kPrime5;
+    }
+    hash += length_;
+
+    const char* p = buffer_;
+    std::size_t size = buffered_;
+    for (; size >= 8; p += 8, size -= 8) {
+      hash ^= round(0, read64(p));
+      hash = rotl(hash, 27) * kPrime1 + kPrime4;
+    }
+    if (size >= 4) {
+      std::uint32_t word;
+      std::memcpy(&word, p, 4);
+      hash ^= word * kPrime1;
+      hash = rotl(hash, 23) * kPrime2 + kPrime3;
+      p += 4;
+      size -= 4;
+    }
+    for (; size > 0; ++p, --size) {
+      hash ^= static_cast<unsigned char>(*p) * kPrime5;
+      hash = rotl(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+ private:
+  static constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+  static constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+  static constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+  static constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+  static constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+  static std::uint64_t rotl(std::uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+  }
+
+  static std::uint64_t round(std::uint64_t lane, std::uint64_t input) {
+    lane += input * kPrime2;
+    return rotl(lane, 31) * kPrime1;
+  }
+
+  static std::uint64_t read64(const char* p) {
+    std::uint64_t word;
+    std::memcpy(&word, p, 8);
+    return word;
+  }
+
+  // one stripe of 32 bytes, 8 bytes for each lane
+  void consume(const char* p) {
+    for (int i = 0; i < 4; ++i) lanes_[i] = round(lanes_[i], read64(p + 8 * i));
+  }
+
+  std::uint64_t lanes_[4];
+  std::uint64_t seed_;
+  std::uint64_t length_ = 0;
+  char buffer_[32];
+  std::size_t buffered_ = 0;
+};
+
+/**
+ * @brief XXH64 of the data in one go
+ */
+inline std::uint64_t contentHash(std::string_view data,
+                                 std::uint64_t seed = 0) {
+  ContentHash hash(seed);
+  hash.update(data);
+  return hash.digest();
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_HASH_HPP
@@ -0,0 +1,491 @@
+/**
+ * @file option_io.hpp
+ * @author Herwig Letofsky
+ * @brief file I/O engines. The blocking engine reads with pread() and
+ * writes with writev() followed by fsync(). The io_uring engine keeps many
+ * reads in flight, across files and across chunks of a large file, and
+ * hands every file to the caller as soon as it is complete, so parsing
+ * overlaps with the reads still in flight. Writes and the fsync() are linked
+ * and go to the kernel in a single submission. The ring is set up with raw
+ * system calls, liburing is not needed; if the kernel refuses io_uring or
+ * does not support the operations, the blocking engine is used instead.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_IO_HPP
+#define OPTION_IO_HPP
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+
+namespace ofp {
+
+enum class IoEngine : uint8_t { blocking = 0x00, uring };
+
+/**
+ * @return false if name is neither "blocking" nor "uring"
+ */
+inline bool parseIoEngine(std::string_view name, IoEngine& engine) {
+  if (name == "blocking") {
+    engine = IoEngine::blocking;
+  } else if (name == "uring") {
+    engine = IoEngine::uring;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief submission and completion queue of an io_uring instance
+ */
+class Ring {
+ public:
+  explicit Ring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) return;
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED ||
+        sqes == MAP_FAILED) {
+      if (sqes != MAP_FAILED) munmap(sqes, sqes_size_);
+      release();
+      return;
+    }
+    auto sq = static_cast<char*>(sq_ring_);
+    auto cq = static_cast<char*>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+    entries_ = params.sq_entries;
+  }
+
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  ~Ring() {
+    if (sqes_) munmap(sqes_, sqes_size_);
+    release();
+  }
+
+  /**
+   * @return false if the kernel does not support io_uring or forbids it
+   */
+  bool valid() const { return sqes_ != nullptr; }
+
+  /**
+   * @return a cleared submission queue entry, nullptr if the queue is full
+   */
+  io_uring_sqe* next() {
+    unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= entries_) {
+      return nullptr;
+    }
+    unsigned index = tail & sq_mask_;
+    sq_array_[index] = index;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++queued_;
+    return sqe;
+  }
+
+  /**
+   * @brief submits the queued entries and waits for the given number of
+   * completions
+   *
+   * @return false on errors, errno is set
+   */
+  bool submit(unsigned wait) {
+    while (true) {
+      long result = syscall(__NR_io_uring_enter, fd_, queued_, wait,
+                            wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (result >= 0) {
+        queued_ -= static_cast<unsigned>(result);
+        return true;
+      }
+      if (errno != EINTR) return false;
+    }
+  }
+
+  /**
+   * @brief calls fn(user_data, result) for every available completion
+   */
+  template <typename Fn>
+  void reap(Fn fn) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      fn(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  unsigned entries() const { return entries_; }
+
+  /**
+   * @return true if the kernel supports all of the operations. Kernels
+   * before 5.6 can not be probed and lack IORING_OP_READ, they set up a
+   * ring and fail the operations with -EINVAL, so they count as none.
+   */
+  bool supports(std::initializer_list<std::uint8_t> opcodes) const {
+    if (!valid()) return false;
+    constexpr unsigned kOps = 256;
+    std::vector<char> buffer(
+        sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op), 0);
+    auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe,
+                kOps) < 0) {
+      return false;
+    }
+    for (std::uint8_t opcode : opcodes) {
+      if (opcode > probe->last_op ||
+          !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  void release() {
+    if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_size_);
+    }
+    if (sq_ring_ && sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_size_);
+    if (fd_ >= 0) ::close(fd_);
+    sq_ring_ = cq_ring_ = nullptr;
+    sqes_ = nullptr;
+    fd_ = -1;
+  }
+
+  int fd_ = -1;
+  void* sq_ring_ = nullptr;
+  void* cq_ring_ = nullptr;
+  std::size_t sq_size_ = 0;
+  std::size_t cq_size_ = 0;
+  std::size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  io_uring_sqe* sqes_ = nullptr;
+  unsigned entries_ = 0;
+  unsigned queued_ = 0;  // entries not yet submitted
+};
+
+namespace detail {
+
+constexpr std::size_t kReadChunkSize = 1024 * 1024;
+constexpr unsigned kRingEntries = 64;
+constexpr std::size_t kFilesInFlight = 16;
+
+inline bool preadAll(int fd, std::string& content) {
+  struct stat info;
+  if (fstat(fd, &info) != 0) return false;
+  content.resize(info.st_size);
+  std::size_t done = 0;
+  while (done < content.size()) {
+    ssize_t result =
+        ::pread(fd, &content[done], content.size() - done, done);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return false;
+    done += result;
+  }
+  return true;
+}
+
+template <typename Fn>
+void readFilesBlocking(const std::vector<std::string>& paths, Fn& fn) {
+  std::string content;
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    int fd = ::open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && preadAll(fd, content);
+    if (fd >= 0) ::close(fd);
+    fn(i, ok, ok ? std::string_view(content) : std::string_view());
+  }
+}
+
+}  // namespace detail
+
+/**
+ * @brief reads whole files and calls fn(index, ok, content) for each of
+ * them, in the order they complete. The content is only valid during the
+ * call.
+ */
+template <typename Fn>
+void readFiles(const std::vector<std::string>& paths, IoEngine engine,
+               Fn fn) {
+  if (engine == IoEngine::blocking) {
+    detail::readFilesBlocking(paths, fn);
+    return;
+  }
+  Ring ring(detail::kRingEntries);
+  if (!ring.supports({IORING_OP_READ})) {
+    detail::readFilesBlocking(paths, fn);
+    return;
+  }
+
+  struct File {
+    std::size_t index = 0;
+    int fd = -1;
+    std::string content;
+    std::size_t pending = 0;  // chunks queued or in flight
+    bool failed = false;
+  };
+  std::vector<File> files(detail::kFilesInFlight);
+  std::vector<std::size_t> free_files;
+  for (std::size_t i = files.size(); i > 0; --i) free_files.push_back(i - 1);
+  // user data of a read: file slot in the upper, file offset in lower bits
+  constexpr int kSlotShift = 48;
+  std::deque<std::uint64_t> reads;  // not yet in the submission queue
+  std::size_t next_path = 0;
+  std::size_t in_flight = 0;
+
+  auto finish = [&](std::size_t slot) {
+    File& file = files[slot];
+    ::close(file.fd);
+    fn(file.index, !file.failed,
+       file.failed ? std::string_view() : std::string_view(file.content));
+    free_files.push_back(slot);
+  };
+  auto chunkEnd = [&](const File& file, std::uint64_t offset) {
+    return std::min<std::uint64_t>(
+        (offset / detail::kReadChunkSize + 1) * detail::kReadChunkSize,
+        file.content.size());
+  };
+
+  while (true) {
+    // open further files while slots are free
+    while (!free_files.empty() && next_path < paths.size()) {
+      std::size_t index = next_path++;
+      int fd = ::open(paths[index].c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat info;
+      if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) ::close(fd);
+        fn(index, false, std::string_view());
+        continue;
+      }
+      if (info.st_size == 0) {
+        ::close(fd);
+        fn(index, true, std::string_view());
+        continue;
+      }
+      std::size_t slot = free_files.back();
+      free_files.pop_back();
+      File& file = files[slot];
+      file.index = index;
+      file.fd = fd;
+      file.failed = false;
+      file.pending = 0;
+      file.content.resize(info.st_size);
+      for (std::uint64_t offset = 0; offset < file.content.size();
+           offset += detail::kReadChunkSize) {
+        reads.push_back((std::uint64_t(slot) << kSlotShift) | offset);
+        ++file.pending;
+      }
+    }
+    // queue the reads which fit into the ring
+    while (!reads.empty()) {
+      std::uint64_t data = reads.front();
+      File& file = files[data >> kSlotShift];
+      std::uint64_t offset = data & ((std::uint64_t(1) << kSlotShift) - 1);
+      if (file.failed) {
+        reads.pop_front();
+        if (--file.pending == 0) finish(data >> kSlotShift);
+        continue;
+      }
+      io_uring_sqe* sqe = ring.next();
+      if (!sqe) break;
+      reads.pop_front();
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = file.fd;
+      sqe->off = offset;
+      sqe->addr = reinterpret_cast<std::uint64_t>(&file.content[offset]);
+      sqe->len = static_cast<std::uint32_t>(chunkEnd(file, offset) - offset);
+      sqe->user_data = data;
+      ++in_flight;
+    }
+    if (in_flight == 0) {
+      if (reads.empty() && next_path == paths.size()) break;
+      continue;
+    }
+    if (!ring.submit(1)) {
+      // the ring broke down, report the remaining files as failed
+      for (std::size_t slot = 0; slot < files.size(); ++slot) {
+        if (std::find(free_files.begin(), free_files.end(), slot) !=
+            free_files.end()) {
+          continue;
+        }
+        files[slot].failed = true;
+        finish(slot);
+      }
+      while (next_path < paths.size()) {
+        fn(next_path++, false, std::string_view());
+      }
+      break;
+    }
+    ring.reap([&](std::uint64_t data, std::int32_t result) {
+      --in_flight;
+      std::size_t slot = data >> kSlotShift;
+      File& file = files[slot];
+      std::uint64_t offset = data & ((std::uint64_t(1) << kSlotShift) - 1);
+      if (result == -EINTR || result == -EAGAIN) {
+        reads.push_back(data);
+        return;
+      }
+      if (result <= 0) {
+        file.failed = true;  // error, or the file shrank meanwhile
+      } else if (offset + result < chunkEnd(file, offset)) {
+        reads.push_back(data + result);  // short read, read the rest
+        return;
+      }
+      if (--file.pending == 0) finish(slot);
+    });
+  }
+}
+
+/**
+ * @brief writes the document at the start of the new file fd and syncs it.
+ * With io_uring all writev() batches and the fsync() are linked and go to
+ * the kernel in one submission.
+ *
+ * @return false on write errors, errno is set
+ */
+inline bool writeDocument(int fd, const Document& document, IoEngine engine) {
+  std::vector<iovec> pieces;
+  std::size_t size = 0;
+  document.forEachPiece([&](std::string_view piece) {
+    pieces.push_back({const_cast<char*>(piece.data()), piece.size()});
+    size += piece.size();
+  });
+  std::size_t batches = (pieces.size() + IOV_MAX - 1) / IOV_MAX;
+  if (engine == IoEngine::uring && batches < 1024) {
+    unsigned entries = 2;
+    while (entries < batches + 1) entries *= 2;
+    Ring ring(entries);
+    if (ring.supports({IORING_OP_WRITEV, IORING_OP_FSYNC})) {
+      std::uint64_t offset = 0;
+      std::vector<std::size_t> expected;
+      for (std::size_t first = 0; first < pieces.size(); first += IOV_MAX) {
+        std::size_t count = std::min<std::size_t>(pieces.size() - first,
+                                                  IOV_MAX);
+        io_uring_sqe* sqe = ring.next();
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->fd = fd;
+        sqe->off = offset;
+        sqe->addr = reinterpret_cast<std::uint64_t>(&pieces[first]);
+        sqe->len = static_cast<std::uint32_t>(count);
+        sqe->user_data = expected.size();
+        std::size_t bytes = 0;
+        for (std::size_t i = first; i < first + count; ++i) {
+          bytes += pieces[i].iov_len;
+        }
+        expected.push_back(bytes);
+        offset += bytes;
+      }
+      io_uring_sqe* sqe = ring.next();
+      sqe->opcode = IORING_OP_FSYNC;
+      sqe->fd = fd;
+      sqe->user_data = expected.size();
+      expected.push_back(0);
+
+      // a failed or short write cancels the rest of the chain, which
+      // completes as well
+      bool ok = true;
+      std::size_t completed = 0;
+      bool submitted = ring.submit(expected.size());
+      while (submitted) {
+        ring.reap([&](std::uint64_t data, std::int32_t result) {
+          ++completed;
+          ok = ok && result >= 0 && std::size_t(result) == expected[data];
+        });
+        if (completed == expected.size()) break;
+        submitted = ring.submit(expected.size() - completed);
+      }
+      if (submitted && ok) return true;
+      // write everything again with blocking calls, offsets are explicit
+    }
+  }
+
+  std::uint64_t offset = 0;
+  for (auto& piece : pieces) {
+    std::size_t done = 0;
+    while (done < piece.iov_len) {
+      ssize_t result =
+          ::pwrite(fd, static_cast<char*>(piece.iov_base) + done,
+                   piece.iov_len - done, offset + done);
+      if (result < 0 && errno == EINTR) continue;
+      if (result < 0) return false;
+      done += result;
+    }
+    offset += piece.iov_len;
+  }
+  return ftruncate(fd, size) == 0 && fsync(fd) == 0;
+}
+
+/**
+ * @brief replaces the file by the document, see replaceFile()
+ *
+ * @return false if the file can not be replaced, errno is set
+ */
+inline bool replaceFile(const char* path, const Document& document,
+                        IoEngine engine) {
+  if (engine == IoEngine::blocking) return replaceFile(path, document);
+  return replaceFileWith(
+      path, [&](int fd) { return writeDocument(fd, document, engine); },
+      false);
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_IO_HPP
@@ -0,0 +1,395 @@
+/**
+ * @file option_journal.hpp
+ * @author Herwig Letofsky
+ * @brief append-only journal at the end of an option file. WRITE and DELETE
+ * in journal mode do not rewrite the file, they append one record per key:
+ *
+ *   #@set <key>=<value>
+ *   #@del <key>
+ *
+ * Records always use the section-qualified key. Readers apply them on top of
+ * the file content, the last record of a key wins. Compaction folds the
+ * records into the file and removes them. Tools which do not know the
+ * journal see the records as comments.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_JOURNAL_HPP
+#define OPTION_JOURNAL_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+#include "option_file.hpp"
+
+namespace ofp {
+
+constexpr std::string_view kJournalSet = "#@set ";
+constexpr std::string_view kJournalDelete = "#@del ";
+
+/**
+ * @brief replayed journal, a key without value has been deleted
+ */
+using JournalState = std::map<std::string, std::optional<std::string>>;
+
+inline bool lineIsJournalRecord(std::string_view line) {
+  return line.substr(0, kJournalSet.size()) == kJournalSet ||
+         line.substr(0, kJournalDelete.size()) == kJournalDelete;
+}
+
+/**
+ * @brief parses a journal record
+ *
+ * @param removed set for deletions, which leave value empty
+ * @return false if the line is no valid journal record
+ */
+inline bool parseJournalRecord(std::string_view line, std::string_view& key,
+                               std::string_view& value, bool& removed) {
+  removed = line.substr(0, kJournalDelete.size()) == kJournalDelete;
+  if (removed) {
+    key = trim(line.substr(kJournalDelete.size()));
+    value = std::string_view();
+    return !key.empty();
+  }
+  return line.substr(0, kJournalSet.size()) == kJournalSet &&
+         splitLine(line.substr(kJournalSet.size()), key, value);
+}
+
+inline std::string journalRecord(const std::string& key,
+                                 const std::string& value) {
+  return std::string(kJournalSet) + key + "=" + value;
+}
+
+inline std::string journalTombstone(const std::string& key) {
+  return std::string(kJournalDelete) + key;
+}
+
+/**
+ * @return index of the first journal record at the end of the lines, or the
+ * number of lines if there is no journal
+ */
+inline std::size_t journalStart(const std::vector<std::string_view>& lines) {
+  std::size_t begin = lines.size();
+  while (begin > 0 && lineIsJournalRecord(lines[begin - 1])) --begin;
+  return begin;
+}
+
+/**
+ * @return offset of the first journal record at the end of the buffer, or
+ * its size if there is no journal. Reads the buffer backwards, so the cost
+ * depends on the journal and not on the buffer size.
+ */
+inline std::size_t journalOffset(std::string_view buffer) {
+  std::size_t offset = buffer.size();
+  std::size_t end = buffer.size();
+  if (end > 0 && buffer[end - 1] == '\n') --end;
+  while (end > 0) {
+    std::size_t newline = buffer.rfind('\n', end - 1);
+    std::size_t begin = newline == std::string_view::npos ? 0 : newline + 1;
+    if (!lineIsJournalRecord(buffer.substr(begin, end - begin))) break;
+    offset = begin;
+    if (begin == 0) break;
+    end = begin - 1;
+  }
+  return offset;
+}
+
+/**
+ * @brief replays the journal records from lines[begin] on
+ */
+inline JournalState readJournal(const std::vector<std::string_view>& lines,
+                                std::size_t begin) {
+  JournalState state;
+  std::string_view key, value;
+  bool removed = false;
+  for (std::size_t i = begin; i < lines.size(); ++i) {
+    if (!parseJournalRecord(lines[i], key, value, removed)) continue;
+    auto& entry = state[std::string(key)];
+    if (removed) {
+      entry.reset();
+    } else {
+      entry = std::string(value);
+    }
+  }
+  return state;
+}
+
+/**
+ * @brief value of the key as READ sees it, the journal wins over the lines
+ */
+inline std::optional<std::string> readValue(
+    const std::vector<std::string_view>& lines, const SectionIndex& index,
+    const JournalState& journal, const std::string& key) {
+  auto record = journal.find(key);
+  if (record != journal.end()) return record->second;
+  auto matches = index.find(key);
+  if (matches.empty()) return std::nullopt;
+  std::string_view line = lines[matches.front().line];
+  return std::string(trim(line.substr(matches.front().eq_pos + 1)));
+}
+
+/**
+ * @brief checks which keys READ finds a value for. The journal is read
+ * first, backwards, since it wins over the lines; the lines are scanned
+ * only until all keys are found.
+ *
+ * @param present one flag per key
+ * @param scanned bytes of the buffer looked at, if not nullptr
+ * @return number of present keys
+ */
+template <typename Keys>
+std::size_t findPresentKeys(std::string_view buffer, const Keys& keys,
+                            std::vector<bool>& present,
+                            std::size_t* scanned = nullptr) {
+  // a repeated key shares the state of its first occurrence
+  std::unordered_map<std::string_view, std::size_t> wanted;
+  for (auto& key : keys) wanted.emplace(key, wanted.size());
+  std::vector<std::optional<bool>> state(wanted.size());
+  std::size_t open = wanted.size();
+
+  std::size_t offset = journalOffset(buffer);
+  std::string_view key, value, name;
+  bool removed = false;
+  forEachLine(buffer.substr(offset), [&](std::string_view line) {
+    if (!parseJournalRecord(line, key, value, removed)) return;
+    auto it = wanted.find(key);
+    if (it == wanted.end()) return;
+    if (!state[it->second]) --open;
+    state[it->second] = !removed;
+  });
+
+  const char* pos = buffer.data();
+  const char* end = pos + offset;
+  std::string section;
+  std::string qualified;
+  while (open > 0 && pos < end) {
+    auto newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    const char* line_end = newline ? newline : end;
+    std::string_view line(pos, line_end - pos);
+    pos = line_end + 1;
+    if (lineIsSection(line, name)) {
+      section.assign(name.data(), name.size());
+    } else if (splitLine(line, key, value)) {
+      qualified.assign(section);
+      if (!section.empty()) qualified += '.';
+      qualified.append(key.data(), key.size());
+      auto it = wanted.find(qualified);
+      if (it != wanted.end() && !state[it->second]) {
+        state[it->second] = true;
+        --open;
+      }
+    }
+  }
+  if (scanned) {
+    *scanned = std::min<std::size_t>(pos - buffer.data(), offset) +
+               buffer.size() - offset;
+  }
+
+  std::size_t count = 0;
+  present.clear();
+  for (auto& requested : keys) {
+    present.push_back(state[wanted.at(requested)].value_or(false));
+    if (present.back()) ++count;
+  }
+  return count;
+}
+
+/**
+ * @brief applies the journal on top of key-value pairs in file order, keys
+ * it adds come last
+ *
+ * @param positions index of every key in entries, outdated afterwards
+ */
+inline void applyJournal(
+    std::vector<std::pair<std::string, std::string>>& entries,
+    std::unordered_map<std::string, std::size_t>& positions,
+    const JournalState& journal) {
+  std::vector<bool> deleted(entries.size(), false);
+  for (auto& record : journal) {
+    auto position = positions.find(record.first);
+    if (position == positions.end()) {
+      if (!record.second) continue;
+      positions.emplace(record.first, entries.size());
+      entries.emplace_back(record.first, *record.second);
+      deleted.push_back(false);
+    } else if (record.second) {
+      entries[position->second].second = *record.second;
+      deleted[position->second] = false;
+    } else {
+      deleted[position->second] = true;
+    }
+  }
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    if (deleted[i]) continue;
+    if (kept != i) entries[kept] = std::move(entries[i]);
+    ++kept;
+  }
+  entries.resize(kept);
+}
+
+/**
+ * @brief all key-value pairs as READ sees them, with section-qualified keys
+ * in file order. The first occurrence of a key wins, or the last one if the
+ * format says so, the journal is applied on top and keys it adds come last.
+ * Formats without '#' comments have no journal.
+ */
+template <typename F = EqualsFormat>
+std::vector<std::pair<std::string, std::string>> readEntries(
+    const std::vector<std::string_view>& lines) {
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::unordered_map<std::string, std::size_t> positions;
+  forEachEntry<F>(lines, [&](std::string_view section, std::string_view key,
+                             std::string_view value, std::size_t) {
+    std::string qualified = qualifiedKey(section, key);
+    auto position = positions.emplace(qualified, entries.size());
+    if (position.second) {
+      entries.emplace_back(std::move(qualified), std::string(value));
+    } else if constexpr (F::kDuplicates == Duplicates::last) {
+      entries[position.first->second].second.assign(value.data(),
+                                                    value.size());
+    }
+  });
+  if constexpr (F::kComment == '#') {
+    applyJournal(entries, positions, readJournal(lines, journalStart(lines)));
+  }
+  return entries;
+}
+
+/**
+ * @brief removes the journal at the end of the document and folds it into
+ * the document together with the given writes and deletes, which win over
+ * the journal records of their keys
+ *
+ * @return number of folded journal records
+ */
+template <typename Writes, typename Deletes>
+std::size_t compactJournal(Document& document, const Writes& writes,
+                           const Deletes& deletes) {
+  const std::vector<std::string_view>& lines = document.lines();
+  std::size_t begin = journalStart(lines);
+  JournalState state = readJournal(lines, begin);
+  for (std::size_t i = begin; i < lines.size(); ++i) document.removeLine(i);
+  for (auto& keyValuePair : writes) state.erase(keyValuePair.first);
+  for (auto& key : deletes) state.erase(key);
+
+  std::vector<std::pair<std::string, std::string>> all_writes;
+  std::vector<std::string> all_deletes;
+  for (auto& entry : state) {
+    if (entry.second) {
+      all_writes.emplace_back(entry.first, *entry.second);
+    } else {
+      all_deletes.emplace_back(entry.first);
+    }
+  }
+  all_writes.insert(all_writes.end(), writes.begin(), writes.end());
+  all_deletes.insert(all_deletes.end(), deletes.begin(), deletes.end());
+  editLines(document, all_writes, all_deletes);
+  return lines.size() - begin;
+}
+
+/**
+ * @brief appends the records to the file with a single write, the file has
+ * to exist. The file is locked like for a rewrite, so the records can not
+ * end up in a file which is just being replaced.
+ *
+ * @return false if the file can not be written, errno is set
+ */
+inline bool appendJournal(const char* path,
+                          const std::vector<std::string>& records) {
+  int fd = detail::openLocked(path, O_RDWR | O_APPEND);
+  if (fd < 0) return false;
+  std::string data;
+  struct stat info;
+  char last = '\n';
+  if (fstat(fd, &info) == 0 && info.st_size > 0 &&
+      pread(fd, &last, 1, info.st_size - 1) == 1 && last != '\n') {
+    data += '\n';
+  }
+  for (auto& record : records) {
+    data += record;
+    data += '\n';
+  }
+  std::size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if (result < 0) {
+      ::close(fd);
+      return false;
+    }
+    written += result;
+  }
+  return ::close(fd) == 0;
+}
+
+/**
+ * @brief counts the journal records at the end of the file by reading it
+ * backwards, so the cost depends on the journal and not on the file size
+ *
+ * @return number of records, at most limit + 1
+ */
+inline std::size_t countJournalRecords(const char* path, std::size_t limit) {
+  constexpr off_t kBlockSize = 64 * 1024;
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    ::close(fd);
+    return 0;
+  }
+
+  // lines are counted from the end, of a line cut by the start of a block
+  // only the head is carried over, which is all lineIsJournalRecord() reads
+  constexpr std::size_t kHeadSize = kJournalSet.size();
+  std::string block(kBlockSize, '\0');
+  std::string partial;
+  off_t pos = info.st_size;
+  std::size_t count = 0;
+  bool last = true;  // the line is the last one of the file
+  auto countLine = [&](std::string_view line) {
+    if (last) {
+      last = false;
+      if (line.empty()) return true;  // after the final newline
+    }
+    return lineIsJournalRecord(line) && ++count <= limit;
+  };
+  bool counting = true;
+  while (counting && pos > 0) {
+    off_t size = std::min(pos, kBlockSize);
+    pos -= size;
+    if (pread(fd, &block[0], size, pos) != size) break;
+    std::string_view lines(block.data(), size);
+    while (counting) {
+      std::size_t newline = lines.rfind('\n');
+      std::string_view head = lines.substr(newline + 1);  // npos + 1 is 0
+      if (!partial.empty() || newline == std::string_view::npos) {
+        partial.insert(0, head.substr(0, kHeadSize));
+        partial.resize(std::min(partial.size(), kHeadSize));
+        head = partial;
+      }
+      if (newline == std::string_view::npos) break;
+      counting = countLine(head);
+      partial.clear();
+      lines = lines.substr(0, newline);
+    }
+  }
+  if (counting && pos == 0) countLine(partial);
+  ::close(fd);
+  return count;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_JOURNAL_HPP
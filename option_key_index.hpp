@@ -0,0 +1,110 @@
+/**
+ * @file option_key_index.hpp
+ * @author Herwig Letofsky
+ * @brief sorted index over the section-qualified keys of an option file,
+ * answering prefix and glob queries like "db.*" or "web.?ort" without
+ * scanning all keys. The literal part of a pattern in front of its first
+ * wildcard selects a range of the sorted keys, only that range is matched
+ * against the pattern. The keys are sorted for the second query, a single
+ * one is answered by a scan, which is cheaper than the sort.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_KEY_INDEX_HPP
+#define OPTION_KEY_INDEX_HPP
+
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ofp {
+
+constexpr std::string_view kWildcards = "*?[";
+
+/**
+ * @return true if the key contains glob wildcards, a backslash alone only
+ * escapes characters and matches like a literal key
+ */
+inline bool isPattern(std::string_view key) {
+  return key.find_first_of(kWildcards) != std::string_view::npos;
+}
+
+class KeyIndex {
+ public:
+  using Entries = std::vector<std::pair<std::string, std::string>>;
+
+  /**
+   * @param entries key-value pairs in file order, see readEntries(), have to
+   * outlive the index
+   */
+  explicit KeyIndex(const Entries& entries) : entries_(entries) {}
+
+  /**
+   * @brief finds all entries whose key matches the glob pattern, or equals
+   * the key if it is no pattern
+   *
+   * @param sorted return the matches in key order instead of file order
+   * @return positions of the matching entries
+   */
+  std::vector<std::size_t> match(const std::string& pattern, bool sorted) {
+    // a backslash escapes the next character, the literal part ends there
+    bool glob = isPattern(pattern);
+    std::string_view prefix(pattern);
+    if (glob) prefix = prefix.substr(0, prefix.find_first_of("*?[\\"));
+    auto matches = [&](const std::string& key) {
+      if (!glob) return key == pattern;
+      return key.compare(0, prefix.size(), prefix) == 0 &&
+             fnmatch(pattern.c_str(), key.c_str(), 0) == 0;
+    };
+    std::vector<std::size_t> positions;
+    if (queries_++ == 0) {
+      for (std::size_t i = 0; i < entries_.size(); ++i) {
+        if (matches(entries_[i].first)) positions.push_back(i);
+      }
+      if (sorted) {
+        std::sort(positions.begin(), positions.end(),
+                  [this](std::size_t a, std::size_t b) { return less(a, b); });
+      }
+      return positions;
+    }
+
+    if (sorted_.size() != entries_.size()) {
+      sorted_.resize(entries_.size());
+      for (std::size_t i = 0; i < sorted_.size(); ++i) sorted_[i] = i;
+      std::sort(sorted_.begin(), sorted_.end(),
+                [this](std::size_t a, std::size_t b) { return less(a, b); });
+    }
+    auto it = std::lower_bound(sorted_.begin(), sorted_.end(), prefix,
+                               [this](std::size_t entry, std::string_view key) {
+                                 return entries_[entry].first < key;
+                               });
+    for (; it != sorted_.end(); ++it) {
+      const std::string& key = entries_[*it].first;
+      if (key.compare(0, prefix.size(), prefix) != 0) break;
+      if (matches(key)) positions.push_back(*it);
+    }
+    if (!sorted) std::sort(positions.begin(), positions.end());
+    return positions;
+  }
+
+ private:
+  // key order, equal keys in file order
+  bool less(std::size_t a, std::size_t b) const {
+    int order = entries_[a].first.compare(entries_[b].first);
+    return order < 0 || (order == 0 && a < b);
+  }
+
+  const Entries& entries_;
+  std::vector<std::size_t> sorted_;  // built for the second query
+  std::size_t queries_ = 0;
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_KEY_INDEX_HPP
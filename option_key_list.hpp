@@ -0,0 +1,158 @@
+/**
+ * @file option_key_list.hpp
+ * @author Herwig Letofsky
+ * @brief command line arguments beyond the limits of argv. Besides the
+ * arguments themselves, "@keys.txt" response files and stdin hold one
+ * argument per line, so a query for 100k keys does not hit ARG_MAX:
+ *
+ *   ofp::ArgumentList arguments;
+ *   arguments.addFile("keys.txt");
+ *   ofp::KeyList keys;
+ *   for (auto argument : arguments) keys.add(argument);
+ *
+ * Files are mapped and the arguments are views into them, nothing is copied
+ * until a key is used. Blank lines and lines starting with '#' are skipped.
+ * Keys to read or delete are collected in a KeyList, key-value pairs to
+ * write in a WriteList, both drop duplicates in O(1).
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_KEY_LIST_HPP
+#define OPTION_KEY_LIST_HPP
+
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "option_file.hpp"
+
+namespace ofp {
+
+/**
+ * @brief arguments from argv, response files and stdin, in the order they
+ * were added
+ */
+class ArgumentList {
+ public:
+  using const_iterator = std::vector<std::string_view>::const_iterator;
+
+  /**
+   * @param argument has to outlive the list, like the strings of argv
+   */
+  void add(std::string_view argument) { arguments_.push_back(argument); }
+
+  /**
+   * @brief adds every line of the file as argument, "-" reads stdin
+   *
+   * @return false if the file can not be read, errno is set
+   */
+  bool addFile(const char* path) {
+    std::string_view content;
+    if (std::string_view(path) == "-") {
+      std::string& buffer = buffers_.emplace_back();
+      constexpr std::size_t kChunkSize = 1 << 20;
+      ssize_t size = 0;
+      do {
+        std::size_t used = buffer.size();
+        buffer.resize(used + kChunkSize);
+        size = ::read(STDIN_FILENO, &buffer[used], kChunkSize);
+        buffer.resize(used + std::max<ssize_t>(size, 0));
+      } while (size > 0);
+      if (size < 0) return false;
+      content = buffer;
+    } else {
+      MappedFile& file = files_.emplace_back();
+      if (!file.open(path)) return false;
+      content = file.view();
+    }
+    forEachLine(content, [this](std::string_view line) {
+      line = trim(line);
+      if (!line.empty() && line[0] != '#') arguments_.push_back(line);
+    });
+    return true;
+  }
+
+  const_iterator begin() const { return arguments_.begin(); }
+  const_iterator end() const { return arguments_.end(); }
+  std::size_t size() const { return arguments_.size(); }
+  bool empty() const { return arguments_.empty(); }
+
+ private:
+  std::vector<std::string_view> arguments_;
+  std::deque<MappedFile> files_;
+  std::deque<std::string> buffers_;
+};
+
+/**
+ * @brief flat table of unique keys, in the order they were first added.
+ * The keys are views, whatever they point to has to outlive the table.
+ */
+class KeyList {
+ public:
+  using const_iterator = std::vector<std::string_view>::const_iterator;
+
+  /**
+   * @return false if the key is in the table already
+   */
+  bool add(std::string_view key) {
+    if (!seen_.insert(key).second) return false;
+    keys_.push_back(key);
+    return true;
+  }
+
+  const_iterator begin() const { return keys_.begin(); }
+  const_iterator end() const { return keys_.end(); }
+  std::size_t size() const { return keys_.size(); }
+  bool empty() const { return keys_.empty(); }
+
+ private:
+  std::vector<std::string_view> keys_;
+  std::unordered_set<std::string_view> seen_;
+};
+
+/**
+ * @brief flat table of key-value pairs to write, in the order their keys
+ * were first added. A key added again keeps its place and takes the new
+ * value, the last write of a key wins. Keys and values are views, like in
+ * KeyList.
+ */
+class WriteList {
+ public:
+  using Write = std::pair<std::string_view, std::string_view>;
+  using const_iterator = std::vector<Write>::const_iterator;
+
+  /**
+   * @return false if the key was in the table already and its value got
+   * replaced
+   */
+  bool set(std::string_view key, std::string_view value) {
+    auto position = positions_.emplace(key, writes_.size());
+    if (!position.second) {
+      writes_[position.first->second].second = value;
+      return false;
+    }
+    writes_.emplace_back(key, value);
+    return true;
+  }
+
+  const_iterator begin() const { return writes_.begin(); }
+  const_iterator end() const { return writes_.end(); }
+  std::size_t size() const { return writes_.size(); }
+  bool empty() const { return writes_.empty(); }
+
+ private:
+  std::vector<Write> writes_;
+  std::unordered_map<std::string_view, std::size_t> positions_;
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_KEY_LIST_HPP
@@ -0,0 +1,255 @@
+/**
+ * @file option_perfect_hash.hpp
+ * @author Herwig Letofsky
+ * @brief minimal perfect hash over a fixed set of option keys, built at
+ * compile time. Every key maps to its own slot, so loading a file resolves
+ * each line to a slot of a flat array with one hash and one compare:
+ *
+ *   constexpr std::array<std::string_view, 3> kKeys{
+ *       "server.port", "server.timeout", "log.level"};
+ *   constexpr ofp::PerfectHash kHash(kKeys);
+ *
+ *   std::array<std::string_view, 3> values;
+ *   std::array<bool, 3> found;
+ *   kHash.load(file.view(), values, found);
+ *
+ * Slots are the positions of the keys in the array the hash was built from.
+ * Duplicate keys are a compile error. The search for the displacements can
+ * run ahead of time as well, option_codegen.hpp writes them into the
+ * generated header so the compiler only has to place the keys.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_PERFECT_HASH_HPP
+#define OPTION_PERFECT_HASH_HPP
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#include "option_file.hpp"
+#include "option_journal.hpp"
+
+namespace ofp {
+
+namespace detail {
+
+constexpr std::uint32_t kMaxDisplacement = 1u << 20;
+
+constexpr std::size_t bucketOf(std::uint64_t hash, std::size_t n) {
+  return (hash >> 32) % n;
+}
+
+// murmur3 finalizer, spreads the displacement over all bits of the slot
+constexpr std::size_t slotOf(std::uint64_t hash, std::uint32_t d,
+                             std::size_t n) {
+  std::uint64_t x = hash ^ (static_cast<std::uint64_t>(d) << 32 | d);
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x % n;
+}
+
+/**
+ * @brief hash and displace construction: the upper half of the key hash
+ * selects one of n buckets, the bucket's displacement mixed into the key
+ * hash selects the slot. Displacements are searched bucket by bucket,
+ * largest bucket first, until all keys of the bucket land in free slots.
+ * Works on plain arrays, so it runs in constant expressions as well as on
+ * keys only known at run time.
+ *
+ * @param displacement n displacements, the result
+ * @param hashes n hashes, scratch
+ * @param scratch 5 * n indices
+ * @param taken n flags, scratch
+ */
+constexpr void findDisplacements(const std::string_view* keys, std::size_t n,
+                                 std::uint32_t* displacement,
+                                 std::uint64_t* hashes, std::size_t* scratch,
+                                 bool* taken) {
+  std::size_t* size = scratch;         // keys per bucket
+  std::size_t* first = scratch + n;    // first member of the bucket
+  std::size_t* members = first + n;    // key indices grouped by bucket
+  std::size_t* order = members + n;    // buckets, largest first
+  std::size_t* slots = order + n;      // slots of the bucket being placed
+  std::size_t largest = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    hashes[i] = hashKey(keys[i]);
+    std::size_t b = bucketOf(hashes[i], n);
+    if (++size[b] > largest) largest = size[b];
+  }
+  for (std::size_t b = 1; b < n; ++b) first[b] = first[b - 1] + size[b - 1];
+  for (std::size_t i = 0; i < n; ++i) {
+    std::size_t b = bucketOf(hashes[i], n);
+    members[first[b]++] = i;
+  }
+  for (std::size_t b = 0; b < n; ++b) first[b] -= size[b];
+  std::size_t count = 0;
+  for (std::size_t bucket_size = largest; bucket_size > 0; --bucket_size) {
+    for (std::size_t b = 0; b < n; ++b) {
+      if (size[b] == bucket_size) order[count++] = b;
+    }
+  }
+
+  for (std::size_t o = 0; o < count; ++o) {
+    std::size_t b = order[o];
+    const std::size_t* bucket = members + first[b];
+    // equal keys share the bucket
+    for (std::size_t i = 0; i < size[b]; ++i) {
+      for (std::size_t j = 0; j < i; ++j) {
+        if (keys[bucket[i]] == keys[bucket[j]]) {
+          throw std::logic_error("duplicate key");
+        }
+      }
+    }
+    for (std::uint32_t d = 0;; ++d) {
+      if (d == kMaxDisplacement) throw std::logic_error("no perfect hash");
+      bool fits = true;
+      for (std::size_t i = 0; i < size[b] && fits; ++i) {
+        slots[i] = slotOf(hashes[bucket[i]], d, n);
+        fits = !taken[slots[i]];
+        for (std::size_t k = 0; k < i && fits; ++k) fits = slots[k] != slots[i];
+      }
+      if (!fits) continue;
+      displacement[b] = d;
+      for (std::size_t i = 0; i < size[b]; ++i) taken[slots[i]] = true;
+      break;
+    }
+  }
+}
+
+}  // namespace detail
+
+/**
+ * @brief minimal perfect hash over N keys, see detail::findDisplacements()
+ */
+template <std::size_t N>
+class PerfectHash {
+ public:
+  static_assert(N > 0, "a perfect hash needs at least one key");
+  static constexpr std::size_t kBuckets = N;
+  static constexpr std::size_t npos = N;
+
+  constexpr explicit PerfectHash(const std::array<std::string_view, N>& keys) {
+    std::array<std::uint64_t, N> hashes{};
+    std::array<std::size_t, 5 * N> scratch{};
+    std::array<bool, N> taken{};
+    detail::findDisplacements(keys.data(), N, displacement_.data(),
+                              hashes.data(), scratch.data(), taken.data());
+    place(keys);
+  }
+
+  /**
+   * @brief the hash of the keys with displacements found before, e.g. by a
+   * code generator, which takes linear time instead of the search
+   */
+  constexpr PerfectHash(const std::array<std::string_view, N>& keys,
+                        const std::array<std::uint32_t, kBuckets>& displacement)
+      : displacement_(displacement) {
+    place(keys);
+  }
+
+  /**
+   * @return the slot of the key or npos if it is not part of the set
+   */
+  constexpr std::size_t find(std::string_view key) const {
+    std::uint64_t hash = hashKey(key);
+    std::size_t slot = slotOf(hash, displacement_[bucketOf(hash)]);
+    return hashes_[slot] == hash && keys_[slot] == key ? index_[slot] : npos;
+  }
+
+  /**
+   * @return the slot of "<section>.<key>", hash being its hashKey()
+   */
+  constexpr std::size_t find(std::uint64_t hash, std::string_view section,
+                             std::string_view key) const {
+    std::size_t slot = slotOf(hash, displacement_[bucketOf(hash)]);
+    return hashes_[slot] == hash && isQualifiedKey(keys_[slot], section, key)
+               ? index_[slot]
+               : npos;
+  }
+
+  /**
+   * @brief collects the values of all keys of the set from the buffer into
+   * the slots of the key, the first occurrence of a key wins like in READ mode
+   * and the journal at the end of the buffer is applied on top
+   *
+   * @return number of keys found
+   */
+  std::size_t load(std::string_view buffer,
+                   std::array<std::string_view, N>& values,
+                   std::array<bool, N>& found) const {
+    std::size_t count = 0;
+    values = {};
+    found = {};
+    std::size_t journal = journalOffset(buffer);
+    std::string_view section;
+    std::uint64_t section_hash = hashKey("");
+    forEachLine(buffer.substr(0, journal), [&](std::string_view line) {
+      std::string_view key, value;
+      if (lineIsSection(line, section)) {
+        section_hash = hashKey(".", hashKey(section));
+      } else if (splitLine(line, key, value)) {
+        std::size_t slot = find(
+            section.empty() ? hashKey(key) : hashKey(key, section_hash),
+            section, key);
+        if (slot != npos && !found[slot]) {
+          values[slot] = value;
+          found[slot] = true;
+          ++count;
+        }
+      }
+    });
+    forEachLine(buffer.substr(journal), [&](std::string_view line) {
+      std::string_view key, value;
+      bool removed = false;
+      if (!parseJournalRecord(line, key, value, removed)) return;
+      std::size_t slot = find(key);
+      if (slot == npos) return;
+      count += !removed - found[slot];
+      values[slot] = value;
+      found[slot] = !removed;
+    });
+    return count;
+  }
+
+ private:
+  static constexpr std::size_t bucketOf(std::uint64_t hash) {
+    return detail::bucketOf(hash, kBuckets);
+  }
+
+  static constexpr std::size_t slotOf(std::uint64_t hash, std::uint32_t d) {
+    return detail::slotOf(hash, d, N);
+  }
+
+  // puts every key into the slot its displacement selects
+  constexpr void place(const std::array<std::string_view, N>& keys) {
+    std::array<bool, N> taken{};
+    for (std::size_t i = 0; i < N; ++i) {
+      std::uint64_t hash = hashKey(keys[i]);
+      std::size_t slot = slotOf(hash, displacement_[bucketOf(hash)]);
+      if (taken[slot]) throw std::logic_error("displacements do not fit");
+      taken[slot] = true;
+      keys_[slot] = keys[i];
+      hashes_[slot] = hash;
+      index_[slot] = i;
+    }
+  }
+
+  std::array<std::uint32_t, kBuckets> displacement_{};
+  std::array<std::string_view, N> keys_{};
+  std::array<std::uint64_t, N> hashes_{};
+  std::array<std::size_t, N> index_{};
+};
+
+template <std::size_t N>
+PerfectHash(const std::array<std::string_view, N>&) -> PerfectHash<N>;
+
+}  // namespace ofp
+
+#endif  // OPTION_PERFECT_HASH_HPP
@@ -0,0 +1,182 @@
+/**
+ * @file option_render.hpp
+ * @author Herwig Letofsky
+ * @brief renders template files, replacing every "{{key}}" placeholder by
+ * the value of the section-qualified key. The option file is parsed once,
+ * the templates are scanned for the "{{" delimiter with memchr(), which
+ * glibc vectorizes, and copied in runs between the placeholders. Several
+ * templates are rendered in parallel:
+ *
+ *   auto entries = ofp::readEntries(ofp::splitLines(file.view()));
+ *   ofp::RenderIndex index(entries);
+ *   auto results = ofp::renderFiles({"app.conf.tmpl", "motd.tmpl"}, index);
+ *
+ * Whitespace inside the braces is ignored, "{{ db.host }}" works as well.
+ * A "{{" without closing "}}" on the rest of the template is copied as is.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_RENDER_HPP
+#define OPTION_RENDER_HPP
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+#include "option_file.hpp"
+
+namespace ofp {
+
+// templates ending in it are rendered to the path without it
+constexpr std::string_view kTemplateSuffix = ".tmpl";
+
+/**
+ * @brief hash index over key-value pairs, which have to outlive it
+ */
+class RenderIndex {
+ public:
+  explicit RenderIndex(
+      const std::vector<std::pair<std::string, std::string>>& entries) {
+    values_.reserve(entries.size());
+    for (auto& entry : entries) values_.emplace(entry.first, entry.second);
+  }
+
+  std::optional<std::string_view> find(std::string_view key) const {
+    auto it = values_.find(key);
+    if (it == values_.end()) return std::nullopt;
+    return it->second;
+  }
+
+ private:
+  std::unordered_map<std::string_view, std::string_view> values_;
+};
+
+/**
+ * @brief appends the template to out with all placeholders replaced
+ *
+ * @param missing keys without a value, their placeholders are kept
+ * @return number of placeholders
+ */
+inline std::size_t renderTemplate(std::string_view text,
+                                  const RenderIndex& index, std::string& out,
+                                  std::vector<std::string>& missing) {
+  std::size_t placeholders = 0;
+  const char* pos = text.data();
+  const char* end = pos + text.size();
+  const char* copied = pos;  // start of the text not copied yet
+  while (pos < end) {
+    auto brace = static_cast<const char*>(std::memchr(pos, '{', end - pos));
+    if (!brace || brace + 1 == end) break;
+    if (brace[1] != '{') {
+      pos = brace + 1;
+      continue;
+    }
+    std::string_view rest(brace + 2, end - brace - 2);
+    std::size_t close = rest.find("}}");
+    if (close == std::string_view::npos) break;
+    std::string_view key = trim(rest.substr(0, close));
+    const char* after = brace + 2 + close + 2;
+    ++placeholders;
+    out.append(copied, brace - copied);
+    if (auto value = index.find(key)) {
+      out.append(value->data(), value->size());
+    } else {
+      out.append(brace, after - brace);
+      if (std::find(missing.begin(), missing.end(), key) == missing.end()) {
+        missing.emplace_back(key);
+      }
+    }
+    copied = pos = after;
+  }
+  out.append(copied, end - copied);
+  return placeholders;
+}
+
+/**
+ * @return path of the rendered template, empty if it goes to stdout
+ */
+inline std::string renderTarget(std::string_view path) {
+  if (path.size() <= kTemplateSuffix.size() ||
+      path.substr(path.size() - kTemplateSuffix.size()) != kTemplateSuffix) {
+    return std::string();
+  }
+  return std::string(path.substr(0, path.size() - kTemplateSuffix.size()));
+}
+
+struct RenderResult {
+  std::string target;   // see renderTarget()
+  std::string output;   // the rendered template if it goes to stdout
+  std::vector<std::string> missing;
+  std::size_t placeholders = 0;
+  std::size_t bytes = 0;
+  bool ok = false;  // false if it could not be read or written
+};
+
+/**
+ * @brief renders the templates on up to threads threads. A template with
+ * missing keys is not written, see RenderResult::missing.
+ *
+ * @param threads 0 for one per CPU
+ * @return one result per template, in the order of paths
+ */
+inline std::vector<RenderResult> renderFiles(
+    const std::vector<std::string>& paths, const RenderIndex& index,
+    unsigned threads = 0) {
+  std::vector<RenderResult> results(paths.size());
+  std::atomic<std::size_t> next{0};
+  auto worker = [&]() {
+    std::string output;
+    for (std::size_t i = next++; i < paths.size(); i = next++) {
+      RenderResult& result = results[i];
+      result.target = renderTarget(paths[i]);
+      MappedFile file;
+      if (!file.open(paths[i].c_str())) continue;
+      output.clear();
+      output.reserve(file.view().size());
+      result.placeholders =
+          renderTemplate(file.view(), index, output, result.missing);
+      result.bytes = output.size();
+      if (!result.missing.empty()) continue;
+      if (result.target.empty()) {
+        result.output = output;
+        result.ok = true;
+        continue;
+      }
+      // a new file gets the permissions of its template
+      FileLock lock;  // held until an existing target is replaced
+      bool exists = lock.lock(result.target.c_str()) || errno != ENOENT;
+      struct stat info;
+      bool has_mode = !exists && ::stat(paths[i].c_str(), &info) == 0;
+      result.ok = replaceFileWith(result.target.c_str(), [&](int fd) {
+        if (has_mode) fchmod(fd, info.st_mode & 07777);
+        return detail::writeAll(fd, output.data(), output.size());
+      });
+    }
+  };
+
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<std::size_t>(threads, paths.size());
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; ++i) workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers) thread.join();
+  return results;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_RENDER_HPP
@@ -0,0 +1,213 @@
+/**
+ * @file option_schema.hpp
+ * @author Herwig Letofsky
+ * @brief typed access to option files for library users. The known options
+ * are declared at compile time, each with its section-qualified key, type and
+ * default value:
+ *
+ *   struct Port : ofp::Option<int> {
+ *     static constexpr std::string_view key = "server.port";
+ *     static constexpr int fallback = 8080;
+ *   };
+ *   struct Timeout : ofp::Option<ofp::Duration> {
+ *     static constexpr std::string_view key = "server.timeout";
+ *     static constexpr ofp::Duration fallback{1500};
+ *   };
+ *
+ *   ofp::MappedFile file;
+ *   file.open("server.conf");
+ *   ofp::Schema<Port, Timeout> options(file.view());
+ *   int port = options.get<Port>();
+ *
+ * Keys are resolved through a compile-time perfect hash, values are parsed
+ * straight from the buffer with std::from_chars when they are accessed, the
+ * buffer has to outlive the schema. Asking for an option which is not part
+ * of the schema does not compile.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_SCHEMA_HPP
+#define OPTION_SCHEMA_HPP
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+#include "option_file.hpp"
+#include "option_perfect_hash.hpp"
+
+namespace ofp {
+
+/**
+ * @brief size value, written with an optional binary suffix: "512", "64K",
+ * "16M", "1G" or "2T", a trailing "B" or "iB" is accepted as well
+ */
+struct Bytes {
+  std::uint64_t value = 0;
+};
+
+/**
+ * @brief duration value, written with an optional unit suffix: "250ms",
+ * "30s", "5m" or "2h", plain numbers are milliseconds
+ */
+using Duration = std::chrono::milliseconds;
+
+template <typename T>
+struct Option {
+  using type = T;
+};
+
+namespace detail {
+
+template <typename T>
+constexpr bool kUnsupportedType = false;
+
+template <typename T>
+bool parseNumber(std::string_view& raw, T& out) {
+  auto result = std::from_chars(raw.data(), raw.data() + raw.size(), out);
+  if (result.ec != std::errc() || result.ptr == raw.data()) return false;
+  raw.remove_prefix(result.ptr - raw.data());
+  return true;
+}
+
+}  // namespace detail
+
+/**
+ * @brief parses a raw value into the given type
+ *
+ * @return false if the value does not hold a valid T
+ */
+template <typename T>
+bool parseValue(std::string_view raw, T& out) {
+  if constexpr (std::is_same_v<T, std::string_view>) {
+    out = raw;
+    return true;
+  } else if constexpr (std::is_same_v<T, bool>) {
+    if (raw == "true" || raw == "yes" || raw == "on" || raw == "1") {
+      out = true;
+    } else if (raw == "false" || raw == "no" || raw == "off" || raw == "0") {
+      out = false;
+    } else {
+      return false;
+    }
+    return true;
+  } else if constexpr (std::is_arithmetic_v<T>) {
+    return detail::parseNumber(raw, out) && raw.empty();
+  } else if constexpr (std::is_same_v<T, Duration>) {
+    Duration::rep count = 0;
+    if (!detail::parseNumber(raw, count)) return false;
+    Duration::rep factor = 0;  // milliseconds per unit
+    if (raw.empty() || raw == "ms") {
+      factor = 1;
+    } else if (raw == "s") {
+      factor = 1000;
+    } else if (raw == "m") {
+      factor = 60 * 1000;
+    } else if (raw == "h") {
+      factor = 60 * 60 * 1000;
+    } else {
+      return false;
+    }
+    // a count which does not fit in milliseconds is no valid duration
+    if (count > std::numeric_limits<Duration::rep>::max() / factor ||
+        count < std::numeric_limits<Duration::rep>::min() / factor) {
+      return false;
+    }
+    out = Duration(count * factor);
+    return true;
+  } else if constexpr (std::is_same_v<T, Bytes>) {
+    std::uint64_t count = 0;
+    if (!detail::parseNumber(raw, count)) return false;
+    unsigned shift = 0;
+    if (!raw.empty()) {
+      std::size_t unit = std::string_view("KMGT").find(raw[0]);
+      if (unit != std::string_view::npos) {
+        shift = 10 * (unit + 1);
+        raw.remove_prefix(1);
+      }
+    }
+    if (!raw.empty() && raw != "B" && (shift == 0 || raw != "iB")) {
+      return false;
+    }
+    if (count > (std::numeric_limits<std::uint64_t>::max() >> shift)) {
+      return false;  // does not fit in 64 bits
+    }
+    out.value = count << shift;
+    return true;
+  } else {
+    static_assert(detail::kUnsupportedType<T>, "unsupported option type");
+  }
+}
+
+/**
+ * @brief typed view on the options of a buffer, see the file description
+ */
+template <typename... Options>
+class Schema {
+ public:
+  static constexpr std::size_t kSize = sizeof...(Options);
+
+  Schema() = default;
+  explicit Schema(std::string_view buffer) { load(buffer); }
+
+  /**
+   * @brief collects the raw values of all options of the schema, the first
+   * occurrence of a key wins like in READ mode and the journal at the end of
+   * the buffer is applied on top
+   */
+  void load(std::string_view buffer) { kHash.load(buffer, values_, found_); }
+
+  template <typename O>
+  bool has() const {
+    return found_[indexOf<O>()];
+  }
+
+  /**
+   * @return the parsed value or std::nullopt if the option is missing or its
+   * value does not fit the option type
+   */
+  template <typename O>
+  std::optional<typename O::type> find() const {
+    constexpr std::size_t i = indexOf<O>();
+    typename O::type value{};
+    if (!found_[i] || !parseValue(values_[i], value)) return std::nullopt;
+    return value;
+  }
+
+  /**
+   * @return the parsed value or the default value of the option
+   */
+  template <typename O>
+  typename O::type get() const {
+    auto value = find<O>();
+    return value ? *value : O::fallback;
+  }
+
+ private:
+  static constexpr std::array<std::string_view, kSize> kKeys{Options::key...};
+  static constexpr PerfectHash<kSize> kHash{kKeys};
+
+  template <typename O>
+  static constexpr std::size_t indexOf() {
+    constexpr bool matches[] = {std::is_same_v<O, Options>...};
+    std::size_t i = 0;
+    while (i < kSize && !matches[i]) ++i;
+    static_assert((std::is_same_v<O, Options> || ...),
+                  "option is not part of this schema");
+    return i;
+  }
+
+  std::array<std::string_view, kSize> values_{};
+  std::array<bool, kSize> found_{};
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_SCHEMA_HPP
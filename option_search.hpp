@@ -0,0 +1,228 @@
+/**
+ * @file option_search.hpp
+ * @author Herwig Letofsky
+ * @brief finds the keys whose value contains a literal text or matches a
+ * glob pattern, e.g. to audit option files for a deprecated hostname.
+ * The mapped file is searched as one buffer with memmem(), which glibc
+ * implements as a vectorized two-way search, and only the lines around a hit
+ * are parsed. Section headers are located on demand with memchr(), so a
+ * file without hits costs about as much as reading it once. A file with hits
+ * is parsed once more, to report only the values READ returns.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_SEARCH_HPP
+#define OPTION_SEARCH_HPP
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "option_file.hpp"
+#include "option_journal.hpp"
+#include "option_key_index.hpp"
+
+namespace ofp {
+
+/**
+ * @brief literal text or glob pattern a value is searched for. A literal
+ * matches anywhere in the value, a glob has to match the whole value like
+ * fnmatch() does, so '*old.example.com*' finds the same as the literal.
+ */
+class SearchPattern {
+ public:
+  explicit SearchPattern(std::string pattern)
+      : pattern_(std::move(pattern)), glob_(isPattern(pattern_)) {
+    needle_ = glob_ ? longestLiteral(pattern_) : pattern_;
+  }
+
+  /**
+   * @return text every matching value contains, empty if any value may match
+   */
+  const std::string& needle() const { return needle_; }
+
+  bool matches(std::string_view value) const {
+    if (!glob_) {
+      return memmem(value.data(), value.size(), needle_.data(),
+                    needle_.size()) != nullptr;
+    }
+    value_.assign(value.data(), value.size());
+    return fnmatch(pattern_.c_str(), value_.c_str(), 0) == 0;
+  }
+
+ private:
+  // longest run of the pattern which every match contains literally
+  static std::string longestLiteral(const std::string& pattern) {
+    std::string best, current;
+    auto flush = [&]() {
+      if (current.size() > best.size()) best = current;
+      current.clear();
+    };
+    for (std::size_t i = 0; i < pattern.size(); ++i) {
+      char c = pattern[i];
+      if (c == '*' || c == '?') {
+        flush();
+      } else if (c == '[') {
+        flush();
+        std::size_t j = i + 1;
+        if (j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^')) ++j;
+        if (j < pattern.size() && pattern[j] == ']') ++j;
+        while (j < pattern.size() && pattern[j] != ']') ++j;
+        i = j;
+      } else if (c == '\\' && i + 1 < pattern.size()) {
+        current += pattern[++i];
+      } else {
+        current += c;
+      }
+    }
+    flush();
+    return best;
+  }
+
+  std::string pattern_;
+  bool glob_;
+  std::string needle_;
+  mutable std::string value_;  // null terminated copy for fnmatch()
+};
+
+namespace detail {
+
+/**
+ * @brief the line READ takes the value of each key from: its first
+ * occurrence, or its last record in the journal at the end of the buffer.
+ * Built on the first query, so a buffer without hits is not parsed.
+ */
+class EffectiveLines {
+ public:
+  explicit EffectiveLines(std::string_view buffer) : buffer_(buffer) {}
+
+  /**
+   * @param line view into the buffer
+   */
+  bool contains(const std::string& qualified_key, std::string_view line) {
+    if (!built_) build();
+    auto it = lines_.find(qualified_key);
+    return it != lines_.end() && it->second == line.data();
+  }
+
+ private:
+  void build() {
+    built_ = true;
+    std::size_t journal = journalOffset(buffer_);
+    std::string_view section, key, value;
+    forEachLine(buffer_.substr(0, journal), [&](std::string_view line) {
+      if (!lineIsSection(line, section) && splitLine(line, key, value)) {
+        lines_.emplace(qualifiedKey(section, key), line.data());
+      }
+    });
+    bool removed = false;
+    forEachLine(buffer_.substr(journal), [&](std::string_view line) {
+      if (parseJournalRecord(line, key, value, removed)) {
+        lines_[std::string(key)] = removed ? nullptr : line.data();
+      }
+    });
+  }
+
+  std::string_view buffer_;
+  bool built_ = false;
+  std::unordered_map<std::string, const char*> lines_;
+};
+
+// reports the line if it holds a key-value pair or a journal record whose
+// value matches and is the value READ returns
+template <typename Fn>
+bool searchLine(std::string_view line, std::string_view section,
+                const SearchPattern& pattern, EffectiveLines& effective,
+                Fn& fn) {
+  std::string_view key, value;
+  bool removed = false;
+  if (lineIsJournalRecord(line)) {
+    if (!parseJournalRecord(line, key, value, removed) || removed) {
+      return false;
+    }
+    section = std::string_view();  // records hold the qualified key
+  } else if (!splitLine(line, key, value)) {
+    return false;
+  }
+  if (!pattern.matches(value) ||
+      !effective.contains(qualifiedKey(section, key), line)) {
+    return false;
+  }
+  fn(section, key, value);
+  return true;
+}
+
+}  // namespace detail
+
+/**
+ * @brief calls fn(section, key, value) for every key-value line and journal
+ * record of the buffer whose value matches, in file order. Only the values
+ * READ returns are reported, lines shadowed by an earlier occurrence of
+ * their key or overridden by the journal are skipped.
+ *
+ * @return number of matches
+ */
+template <typename Fn>
+std::size_t searchValues(std::string_view buffer, const SearchPattern& pattern,
+                         Fn fn) {
+  std::size_t matches = 0;
+  detail::EffectiveLines effective(buffer);
+  std::string_view section;
+  const std::string& needle = pattern.needle();
+  if (needle.empty()) {
+    forEachLine(buffer, [&](std::string_view line) {
+      if (lineIsSection(line, section)) return;
+      if (detail::searchLine(line, section, pattern, effective, fn)) ++matches;
+    });
+    return matches;
+  }
+
+  const char* begin = buffer.data();
+  const char* end = begin + buffer.size();
+  const char* pos = begin;
+  const char* scanned = begin;  // section headers are known up to here
+  while (pos < end) {
+    auto hit = static_cast<const char*>(
+        memmem(pos, end - pos, needle.data(), needle.size()));
+    if (!hit) break;
+    auto newline = static_cast<const char*>(memrchr(pos, '\n', hit - pos));
+    const char* line_begin = newline ? newline + 1 : pos;
+    newline = static_cast<const char*>(std::memchr(hit, '\n', end - hit));
+    const char* line_end = newline ? newline : end;
+
+    // only lines starting with '[' can be section headers
+    while (scanned < line_begin) {
+      auto bracket = static_cast<const char*>(
+          std::memchr(scanned, '[', line_begin - scanned));
+      if (!bracket) break;
+      newline = static_cast<const char*>(
+          memrchr(scanned, '\n', bracket - scanned));
+      const char* header_begin = newline ? newline + 1 : scanned;
+      newline = static_cast<const char*>(
+          std::memchr(bracket, '\n', line_begin - bracket));
+      const char* header_end = newline ? newline : line_begin;
+      lineIsSection(std::string_view(header_begin, header_end - header_begin),
+                    section);
+      scanned = header_end + 1;
+    }
+
+    std::string_view line(line_begin, line_end - line_begin);
+    if (!lineIsSection(line, section) &&
+        detail::searchLine(line, section, pattern, effective, fn)) {
+      ++matches;
+    }
+    pos = line_end + 1;
+    scanned = pos;
+  }
+  return matches;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_SEARCH_HPP
@@ -0,0 +1,348 @@
+/**
+ * @file option_shared_table.hpp
+ * @author Herwig Letofsky
+ * @brief read-only key-value table in POSIX shared memory, so many processes
+ * on a host can look up options without parsing the file themselves. One
+ * process publishes the file:
+ *
+ *   ofp::SharedTable::publish("/service-options", entries);
+ *
+ * and every reader maps the segment and looks keys up:
+ *
+ *   ofp::SharedTable table;
+ *   table.open("/service-options");
+ *   std::optional<std::string> port;
+ *   table.lookup("server.port", port);
+ *
+ * Keys and values are interned (see option_string_pool.hpp), an entry of the
+ * open-addressing hash table in the segment is the pair of 32-bit ids of its
+ * key and value. A table of the strings by id and the strings themselves
+ * follow it, a repeated value is stored only once. The segment is
+ * guarded by a sequence lock: a publisher makes the sequence odd, replaces
+ * the table and makes it even again, readers copy what they need and retry
+ * if the sequence changed meanwhile. Readers never take a lock and never
+ * block a publisher. The segment only grows, readers remap it when a new
+ * version needs more space than they have mapped.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_SHARED_TABLE_HPP
+#define OPTION_SHARED_TABLE_HPP
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_file.hpp"
+#include "option_string_pool.hpp"
+
+namespace ofp {
+
+class SharedTable {
+ public:
+  struct Stats {
+    std::uint64_t version = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+    std::size_t slot_bytes = 0;  // the hash table of id pairs
+    std::size_t span_bytes = 0;  // the strings by id
+    StringPool::Stats strings;   // interning of keys and values
+
+    /**
+     * @return bytes of the hash table and the strings by id per entry,
+     * without the strings themselves
+     */
+    double bytesPerEntry() const {
+      return entries ? static_cast<double>(slot_bytes + span_bytes) / entries
+                     : 0.0;
+    }
+  };
+
+  SharedTable() = default;
+  SharedTable(const SharedTable&) = delete;
+  SharedTable& operator=(const SharedTable&) = delete;
+  ~SharedTable() { close(); }
+
+  /**
+   * @brief publishes the entries as a new version of the segment, creating
+   * it if necessary. Concurrent publishers are serialized by a file lock.
+   *
+   * @return false if the segment can not be created or written, or the
+   * entries do not fit the 32-bit offsets of the segment, errno is set
+   */
+  static bool publish(const char* name,
+                      const std::vector<std::pair<std::string, std::string>>&
+                          entries,
+                      Stats* stats = nullptr) {
+    Stats built;
+    std::string image;
+    if (!buildImage(entries, image, built)) {
+      errno = EFBIG;
+      return false;
+    }
+    std::size_t required = sizeof(Header) + image.size();
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    struct stat info;
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &info) != 0 ||
+        (static_cast<std::size_t>(info.st_size) < required &&
+         ftruncate(fd, required) != 0)) {
+      ::close(fd);
+      return false;
+    }
+    std::size_t size = std::max<std::size_t>(info.st_size, required);
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+
+    auto header = static_cast<Header*>(data);
+    if (header->magic != kMagic) {
+      header = new (data) Header();
+      header->magic = kMagic;
+    }
+    std::uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+    if (sequence & 1) ++sequence;  // a publisher died while writing
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    header->version += 1;
+    header->size = required;
+    header->capacity = built.slot_bytes / sizeof(Slot);
+    header->count = built.entries;
+    header->strings = built.span_bytes / sizeof(Span);
+    std::memcpy(static_cast<char*>(data) + sizeof(Header), image.data(),
+                image.size());
+
+    header->sequence.store(sequence + 2, std::memory_order_release);
+    if (stats) {
+      *stats = built;
+      stats->version = header->version;
+      stats->bytes = required;
+    }
+    munmap(data, size);
+    ::close(fd);  // releases the lock
+    return true;
+  }
+
+  /**
+   * @return false if the segment does not exist or can not be mapped
+   */
+  bool open(const char* name) {
+    close();
+    fd_ = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd_ < 0) return false;
+    if (!remap()) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (data_) munmap(const_cast<void*>(data_), mapped_);
+    if (fd_ >= 0) ::close(fd_);
+    data_ = nullptr;
+    mapped_ = 0;
+    fd_ = -1;
+  }
+
+  /**
+   * @param value receives the value of the section-qualified key,
+   * std::nullopt if it is not part of the table
+   * @return false if the segment can not be remapped, or no consistent
+   * version could be read as publishers kept replacing it (errno EAGAIN)
+   */
+  bool lookup(std::string_view key, std::optional<std::string>& value) {
+    value.reset();
+    std::uint64_t hash = hashKey(key);
+    for (unsigned attempt = 0; attempt < kMaxAttempts; ++attempt) {
+      std::uint64_t sequence =
+          header()->sequence.load(std::memory_order_acquire);
+      if (sequence & 1) {
+        sched_yield();  // a publisher is writing
+        continue;
+      }
+      std::size_t size = header()->size;
+      std::size_t capacity = header()->capacity;
+      std::size_t strings = header()->strings;
+      if (size > mapped_) {
+        if (!remap()) return false;
+        continue;
+      }
+
+      bool consistent = find(size, capacity, strings, key, hash, value);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header()->sequence.load(std::memory_order_relaxed) == sequence &&
+          consistent) {
+        return true;
+      }
+      value.reset();
+    }
+    errno = EAGAIN;
+    return false;
+  }
+
+  /**
+   * @return the version of the table, incremented by every publish
+   */
+  std::uint64_t version() const { return data_ ? header()->version : 0; }
+
+ private:
+  static constexpr std::uint64_t kMagic = 0x3270667470666f00ULL;
+  static constexpr unsigned kMaxAttempts = 1u << 20;
+
+  struct Header {
+    std::uint64_t magic = 0;
+    std::atomic<std::uint64_t> sequence{0};
+    std::uint64_t version = 0;
+    std::uint64_t size = 0;  // bytes of the segment in use
+    std::uint64_t capacity = 0;  // slots
+    std::uint64_t count = 0;     // entries
+    std::uint64_t strings = 0;   // spans
+  };
+
+  // ids of an entry, empty slots have the key id kNoString
+  struct Slot {
+    StringPool::Id key_id;
+    StringPool::Id value_id;
+  };
+
+  // a string of the pool, by offset into the segment
+  struct Span {
+    std::uint32_t offset;
+    std::uint32_t size;
+  };
+
+  static constexpr StringPool::Id kNoString = UINT32_MAX;
+
+  static std::size_t capacityFor(std::size_t count) {
+    std::size_t capacity = 8;
+    while (capacity < 2 * count) capacity *= 2;
+    return capacity;
+  }
+
+  // slots, spans and string pool, as they follow the header in the
+  // segment, false if the strings do not fit the 32-bit offsets. The first
+  // entry of a key wins.
+  static bool buildImage(
+      const std::vector<std::pair<std::string, std::string>>& entries,
+      std::string& image, Stats& stats) {
+    std::size_t capacity = capacityFor(entries.size());
+    std::vector<Slot> slots(capacity, Slot{kNoString, kNoString});
+    StringPool pool;
+    stats.entries = 0;
+    for (auto& entry : entries) {
+      if (entry.first.empty()) continue;
+      std::optional<StringPool::Id> key = pool.intern(entry.first);
+      std::optional<StringPool::Id> value = pool.intern(entry.second);
+      if (!key || !value) return false;
+      std::size_t i = hashKey(entry.first) & (capacity - 1);
+      while (slots[i].key_id != kNoString && slots[i].key_id != *key) {
+        i = (i + 1) & (capacity - 1);
+      }
+      if (slots[i].key_id == *key) continue;
+      slots[i] = Slot{*key, *value};
+      ++stats.entries;
+    }
+
+    std::size_t strings_offset = sizeof(Header) + capacity * sizeof(Slot) +
+                                 pool.size() * sizeof(Span);
+    if (strings_offset + pool.data().size() > UINT32_MAX) return false;
+    std::vector<Span> spans;
+    spans.reserve(pool.size());
+    for (StringPool::Id id = 0; id < pool.size(); ++id) {
+      spans.push_back(Span{
+          static_cast<std::uint32_t>(strings_offset + pool.offset(id)),
+          static_cast<std::uint32_t>(pool.view(id).size())});
+    }
+    stats.slot_bytes = capacity * sizeof(Slot);
+    stats.span_bytes = spans.size() * sizeof(Span);
+    stats.strings = pool.stats();
+    image.assign(reinterpret_cast<const char*>(slots.data()),
+                 stats.slot_bytes);
+    image.append(reinterpret_cast<const char*>(spans.data()),
+                 stats.span_bytes);
+    image += pool.data();
+    return true;
+  }
+
+  const Header* header() const { return static_cast<const Header*>(data_); }
+
+  // copies the value out of the table, false if the snapshot is torn
+  bool find(std::size_t size, std::size_t capacity, std::size_t strings,
+            std::string_view key, std::uint64_t hash,
+            std::optional<std::string>& value) const {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        sizeof(Header) + capacity * sizeof(Slot) + strings * sizeof(Span) >
+            size) {
+      return false;
+    }
+    auto base = static_cast<const char*>(data_);
+    auto slots = reinterpret_cast<const Slot*>(header() + 1);
+    auto spans = reinterpret_cast<const Span*>(slots + capacity);
+    // copies the span of the id, false if it is out of the segment
+    auto spanOf = [&](StringPool::Id id, Span& span) {
+      if (id >= strings) return false;
+      std::memcpy(&span, &spans[id], sizeof(Span));
+      return std::size_t(span.offset) + span.size <= size;
+    };
+    std::size_t i = hash & (capacity - 1);
+    for (std::size_t probe = 0; probe < capacity; ++probe) {
+      Slot slot;
+      std::memcpy(&slot, &slots[i], sizeof(Slot));
+      if (slot.key_id == kNoString) return true;
+      Span key_span, value_span;
+      if (!spanOf(slot.key_id, key_span)) return false;
+      if (key_span.size == key.size() &&
+          std::memcmp(base + key_span.offset, key.data(), key.size()) == 0) {
+        if (!spanOf(slot.value_id, value_span)) return false;
+        value.emplace(base + value_span.offset, value_span.size);
+        return true;
+      }
+      i = (i + 1) & (capacity - 1);
+    }
+    return true;
+  }
+
+  bool remap() {
+    struct stat info;
+    if (fstat(fd_, &info) != 0 ||
+        static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+      return false;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) return false;
+    if (data_) munmap(const_cast<void*>(data_), mapped_);
+    data_ = data;
+    mapped_ = info.st_size;
+    return header()->magic == kMagic;
+  }
+
+  int fd_ = -1;
+  const void* data_ = nullptr;
+  std::size_t mapped_ = 0;
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_SHARED_TABLE_HPP
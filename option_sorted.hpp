@@ -0,0 +1,129 @@
+/**
+ * @file option_sorted.hpp
+ * @author Herwig Letofsky
+ * @brief canonically sorted option files. normalizeFile() in
+ * option_external_sort.hpp rewrites a file with section-qualified keys in
+ * byte order, one line per key, and marks it with a first line "#@sorted".
+ * READ on a marked file binary-searches the mapped text for the key instead
+ * of splitting the file into lines, so a lookup costs O(log n) line reads
+ * and no index has to be stored next to the file:
+ *
+ *   #@sorted
+ *   # primary database
+ *   db.host=db1.example.net
+ *   db.port=5432
+ *   server.port=8080
+ *
+ * The journal at the end of a sorted file is applied as usual, WRITE and
+ * COMPACT insert new keys at their sorted position.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_SORTED_HPP
+#define OPTION_SORTED_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_file.hpp"
+#include "option_journal.hpp"
+
+namespace ofp {
+
+inline bool isSorted(std::string_view buffer) {
+  return buffer.substr(0, kSortedMarker.size()) == kSortedMarker &&
+         (buffer.size() == kSortedMarker.size() ||
+          buffer[kSortedMarker.size()] == '\n');
+}
+
+/**
+ * @brief binary search for the key in the lines of a sorted file
+ *
+ * @param buffer content of the file without its journal
+ * @return trimmed value, std::nullopt if the key is missing
+ */
+inline std::optional<std::string_view> findSorted(std::string_view buffer,
+                                                  std::string_view key) {
+  const char* begin = buffer.data();
+  const char* end = begin + buffer.size();
+  std::string_view line_key, value;
+  // first key-value line starting at or after pos, end if there is none
+  auto keyLineAt = [&](const char* pos) {
+    if (pos > begin && pos[-1] != '\n') {
+      auto newline = static_cast<const char*>(
+          std::memchr(pos, '\n', end - pos));
+      pos = newline ? newline + 1 : end;
+    }
+    while (pos < end) {
+      auto newline = static_cast<const char*>(
+          std::memchr(pos, '\n', end - pos));
+      const char* line_end = newline ? newline : end;
+      if (splitLine(std::string_view(pos, line_end - pos), line_key, value)) {
+        return std::make_pair(pos, line_end);
+      }
+      pos = line_end + 1;
+    }
+    return std::make_pair(end, end);
+  };
+
+  // key lines starting before low are less than key, the ones starting at
+  // or after high are not
+  const char* low = begin;
+  const char* high = end;
+  while (low < high) {
+    const char* mid = low + (high - low) / 2;
+    auto line = keyLineAt(mid);
+    if (line.first >= high || line_key >= key) {
+      high = mid;
+    } else {
+      low = std::min(line.second + 1, end);
+    }
+  }
+  auto line = keyLineAt(low);
+  if (line.first == end || line_key != key) return std::nullopt;
+  return value;
+}
+
+/**
+ * @brief READ on a sorted file without splitting it into lines
+ */
+class SortedFile {
+ public:
+  /**
+   * @param buffer content of the file, has to outlive the object
+   */
+  explicit SortedFile(std::string_view buffer) {
+    std::size_t offset = journalOffset(buffer);
+    lines_ = buffer.substr(0, offset);
+    std::vector<std::string_view> records =
+        splitLines(buffer.substr(offset));
+    journal_length_ = records.size();
+    journal_ = readJournal(records, 0);
+  }
+
+  std::optional<std::string> find(const std::string& key) const {
+    auto record = journal_.find(key);
+    if (record != journal_.end()) return record->second;
+    auto value = findSorted(lines_, key);
+    if (!value) return std::nullopt;
+    return std::string(*value);
+  }
+
+  std::size_t journalLength() const { return journal_length_; }
+
+ private:
+  std::string_view lines_;
+  JournalState journal_;
+  std::size_t journal_length_;
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_SORTED_HPP
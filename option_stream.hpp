@@ -0,0 +1,332 @@
+/**
+ * @file option_stream.hpp
+ * @author Herwig Letofsky
+ * @brief READ, WRITE and DELETE as a filter between file descriptors, for
+ * pipelines which produce and consume option data on the fly:
+ *
+ *   generate-config | option_file_parser -f - -w db.host=10.0.0.1 | deploy
+ *
+ * The input is read in large chunks and parsed line by line, memory is
+ * bounded by the chunk size and the longest line. Pipes on either side are
+ * enlarged to the chunk size, so each side moves a chunk per system call.
+ *
+ * The edits are the ones of editLines() with two differences, as nothing
+ * already written can be taken back. A journal at the end of the input is
+ * kept, only its records of the edited keys are dropped since the edits win
+ * over them. A new key which editLines() would insert in front of the end
+ * of the input is appended as journal record instead, which readers apply
+ * the same way. READ sees the same values either way.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_STREAM_HPP
+#define OPTION_STREAM_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+#include "option_file.hpp"
+#include "option_journal.hpp"
+
+namespace ofp {
+
+struct StreamStats {
+  std::size_t input_bytes = 0;
+  std::size_t output_bytes = 0;
+  std::size_t lines = 0;
+  std::size_t edits = 0;  // lines replaced, removed or appended
+  double seconds = 0;
+
+  double throughput() const { return seconds > 0 ? input_bytes / seconds : 0; }
+};
+
+namespace detail {
+
+constexpr std::size_t kStreamChunkSize = 1 << 20;
+
+// larger pipes save context switches, fails for anything but a pipe
+inline void enlargePipe(int fd) {
+#ifdef F_SETPIPE_SZ
+  fcntl(fd, F_SETPIPE_SZ, static_cast<int>(kStreamChunkSize));
+#else
+  (void)fd;
+#endif
+}
+
+/**
+ * @brief calls fn(line, terminated) for every line read from fd, without
+ * the newline, terminated is false for a last line without one
+ *
+ * @return false on a read error, errno is set
+ */
+template <typename Fn>
+bool forEachStreamLine(int fd, std::size_t& bytes, Fn fn) {
+  enlargePipe(fd);
+  std::string buffer(kStreamChunkSize, '\0');
+  std::size_t begin = 0;  // first byte of the current line
+  std::size_t end = 0;    // end of the data read
+  while (true) {
+    if (begin > 0) {
+      // keep the partial line, at the start of the buffer
+      std::memmove(&buffer[0], &buffer[begin], end - begin);
+      end -= begin;
+      begin = 0;
+    }
+    if (end == buffer.size()) buffer.resize(2 * buffer.size());  // long line
+    ssize_t size = ::read(fd, &buffer[end], buffer.size() - end);
+    if (size < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (size == 0) break;
+    bytes += size;
+    std::size_t scanned = end;
+    end += size;
+    while (true) {
+      auto newline = static_cast<const char*>(
+          std::memchr(&buffer[scanned], '\n', end - scanned));
+      if (!newline) break;
+      std::size_t line_end = newline - buffer.data();
+      fn(std::string_view(&buffer[begin], line_end - begin), true);
+      begin = scanned = line_end + 1;
+    }
+  }
+  if (begin < end) fn(std::string_view(&buffer[begin], end - begin), false);
+  return true;
+}
+
+/**
+ * @brief collects output and writes it in chunks
+ */
+class StreamWriter {
+ public:
+  explicit StreamWriter(int fd) : fd_(fd) {
+    enlargePipe(fd);
+    buffer_.reserve(kStreamChunkSize);
+  }
+
+  void append(std::string_view data) {
+    buffer_.append(data.data(), data.size());
+    if (buffer_.size() >= kStreamChunkSize) flush();
+  }
+
+  // appends a line, adding the newline the previous line might lack
+  void appendLine(std::string_view line, bool terminated = true) {
+    if (!terminated_) append("\n");
+    append(line);
+    if (terminated) append("\n");
+    terminated_ = terminated;
+  }
+
+  bool flush() {
+    ok_ = ok_ && writeAll(fd_, buffer_.data(), buffer_.size());
+    bytes_ += buffer_.size();
+    buffer_.clear();
+    return ok_;
+  }
+
+  std::size_t bytes() const { return bytes_ + buffer_.size(); }
+
+ private:
+  int fd_;
+  std::string buffer_;
+  std::size_t bytes_ = 0;
+  bool terminated_ = true;
+  bool ok_ = true;
+};
+
+}  // namespace detail
+
+/**
+ * @brief copies the option lines from in to out with the writes and deletes
+ * applied, see the file description
+ *
+ * @param writes section-qualified keys and their values, without duplicates
+ * @param deletes section-qualified keys
+ * @return false if in can not be read or out not be written, errno is set
+ */
+template <typename Writes, typename Deletes>
+bool streamEdits(int in, int out, const Writes& writes, const Deletes& deletes,
+                 StreamStats* stats = nullptr) {
+  auto start = std::chrono::steady_clock::now();
+  StreamStats local;
+  StreamStats& s = stats ? *stats : local;
+
+  std::unordered_map<std::string_view, std::size_t> write_at;
+  for (std::size_t i = 0; i < writes.size(); ++i) {
+    write_at.emplace(writes[i].first, i);
+  }
+  std::vector<bool> written(writes.size(), false);
+  std::unordered_set<std::string_view> deleted(deletes.begin(), deletes.end());
+
+  detail::StreamWriter writer(out);
+  std::unordered_set<std::string> sections;
+  std::string section;
+  std::string qualified;
+  bool sorted = false;
+  bool journal_tail = false;  // the last line was a journal record
+  bool ok = detail::forEachStreamLine(
+      in, s.input_bytes, [&](std::string_view line, bool terminated) {
+        if (s.lines++ == 0 && line == kSortedMarker) sorted = true;
+        std::string_view name, key, value;
+        bool removed = false;
+        if (lineIsSection(line, name)) {
+          section.assign(name.data(), name.size());
+          sections.insert(section);
+          journal_tail = false;
+        } else if (lineIsJournalRecord(line)) {
+          journal_tail = true;
+          if (parseJournalRecord(line, key, value, removed) &&
+              (write_at.count(key) || deleted.count(key))) {
+            ++s.edits;
+            return;
+          }
+        } else {
+          journal_tail = false;
+          if (splitLine(line, key, value)) {
+            qualified.assign(section);
+            if (!section.empty()) qualified += '.';
+            qualified.append(key.data(), key.size());
+            if (deleted.count(qualified)) {
+              ++s.edits;
+              return;
+            }
+            auto it = write_at.find(qualified);
+            if (it != write_at.end() && !written[it->second]) {
+              written[it->second] = true;
+              const std::string& new_value = writes[it->second].second;
+              if (value != new_value) {
+                ++s.edits;
+                writer.appendLine(std::string(key) + "=" + new_value,
+                                  terminated);
+                return;
+              }
+            }
+          }
+        }
+        writer.appendLine(line, terminated);
+      });
+
+  // new keys, where editLines() would put them if that is the end of the
+  // input, as journal records otherwise
+  std::vector<std::string> records;
+  std::map<std::string, std::vector<std::string>> new_sections;
+  for (std::size_t i = 0; i < writes.size(); ++i) {
+    if (written[i]) continue;
+    ++s.edits;
+    const std::string& key = writes[i].first;
+    const std::string& value = writes[i].second;
+    std::size_t dot = key.rfind('.');
+    for (; dot != std::string::npos && dot > 0; dot = key.rfind('.', dot - 1)) {
+      if (sections.count(key.substr(0, dot))) break;
+    }
+    bool existing = dot != std::string::npos && dot > 0;
+    if (journal_tail) {
+      records.push_back(journalRecord(key, value));
+    } else if (existing && key.compare(0, dot, section) == 0 &&
+               dot == section.size()) {
+      writer.appendLine(key.substr(dot + 1) + "=" + value);
+    } else if (!existing && !sections.empty() &&
+               (dot = key.rfind('.')) != std::string::npos && dot > 0) {
+      new_sections[key.substr(0, dot)].push_back(key.substr(dot + 1) + "=" +
+                                                 value);
+    } else if (!existing && sections.empty() && !sorted) {
+      writer.appendLine(key + "=" + value);
+    } else {
+      records.push_back(journalRecord(key, value));
+    }
+  }
+  for (auto& new_section : new_sections) {
+    writer.appendLine("[" + new_section.first + "]");
+    for (auto& line : new_section.second) writer.appendLine(line);
+  }
+  for (auto& record : records) writer.appendLine(record);
+
+  ok = writer.flush() && ok;
+  s.output_bytes = writer.bytes();
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  s.seconds = time.count();
+  return ok;
+}
+
+/**
+ * @brief reads the values of the keys from in, as READ does
+ *
+ * @param keys section-qualified keys, no patterns
+ * @param values one per key, std::nullopt for a missing key
+ * @return false if in can not be read, errno is set
+ */
+template <typename Keys>
+bool streamValues(int in, const Keys& keys,
+                  std::vector<std::optional<std::string>>& values,
+                  StreamStats* stats = nullptr) {
+  auto start = std::chrono::steady_clock::now();
+  StreamStats local;
+  StreamStats& s = stats ? *stats : local;
+
+  std::unordered_map<std::string_view, std::size_t> wanted;
+  for (auto& key : keys) wanted.emplace(key, wanted.size());
+  values.assign(keys.size(), std::nullopt);
+  std::vector<std::optional<std::string>> found(wanted.size());
+  // records of the journal so far, dropped if a line follows them
+  std::map<std::size_t, std::optional<std::string>> journal;
+
+  std::string section;
+  std::string qualified;
+  bool ok = detail::forEachStreamLine(
+      in, s.input_bytes, [&](std::string_view line, bool) {
+        ++s.lines;
+        std::string_view name, key, value;
+        bool removed = false;
+        if (lineIsJournalRecord(line)) {
+          if (!parseJournalRecord(line, key, value, removed)) return;
+          auto it = wanted.find(key);
+          if (it == wanted.end()) return;
+          auto& record = journal[it->second];
+          if (removed) {
+            record.reset();
+          } else {
+            record = std::string(value);
+          }
+          return;
+        }
+        journal.clear();
+        if (lineIsSection(line, name)) {
+          section.assign(name.data(), name.size());
+        } else if (splitLine(line, key, value)) {
+          qualified.assign(section);
+          if (!section.empty()) qualified += '.';
+          qualified.append(key.data(), key.size());
+          auto it = wanted.find(qualified);
+          if (it != wanted.end() && !found[it->second]) {
+            found[it->second] = std::string(value);
+          }
+        }
+      });
+  for (auto& record : journal) found[record.first] = std::move(record.second);
+
+  std::size_t i = 0;
+  for (auto& key : keys) values[i++] = found[wanted.at(key)];
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  s.seconds = time.count();
+  return ok;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_STREAM_HPP
@@ -0,0 +1,129 @@
+/**
+ * @file option_string_pool.hpp
+ * @author Herwig Letofsky
+ * @brief interning of keys and values for option tables which stay resident,
+ * like the shared memory table of option_shared_table.hpp. Option files
+ * repeat values a lot (hostnames, booleans, paths), the pool stores every
+ * distinct string once and hands out 32-bit ids, so an entry of the table is
+ * a pair of ids:
+ *
+ *   ofp::StringPool pool;
+ *   std::optional<ofp::StringPool::Id> id = pool.intern("localhost");
+ *   std::size_t offset = pool.offset(*id);  // into pool.data()
+ *
+ * The offsets limit the pool to 4 GiB, intern() fails beyond that.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_STRING_POOL_HPP
+#define OPTION_STRING_POOL_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "option_file.hpp"
+
+namespace ofp {
+
+/**
+ * @brief hash-consing string pool, equal strings get the same id. Ids are
+ * dense and stay valid, views are invalidated by intern().
+ */
+class StringPool {
+ public:
+  using Id = std::uint32_t;
+
+  struct Stats {
+    std::size_t lookups = 0;  // calls of intern()
+    std::size_t hits = 0;     // calls which found the string in the pool
+    std::size_t bytes_requested = 0;
+    std::size_t bytes_stored = 0;
+
+    double hitRate() const {
+      return lookups ? static_cast<double>(hits) / lookups : 0.0;
+    }
+    std::size_t bytesSaved() const { return bytes_requested - bytes_stored; }
+  };
+
+  /**
+   * @return id of the string, which is added if it is not yet part of the
+   * pool, std::nullopt if it does not fit into the 4 GiB of the pool
+   */
+  std::optional<Id> intern(std::string_view s) {
+    ++stats_.lookups;
+    stats_.bytes_requested += s.size();
+    if (2 * (spans_.size() + 1) > slots_.size()) grow();
+    std::size_t slot = probe(s);
+    if (slots_[slot] != kEmpty) {
+      ++stats_.hits;
+      return slots_[slot];
+    }
+    if (s.size() > kMaxSize - data_.size() || spans_.size() >= kEmpty) {
+      return std::nullopt;
+    }
+    Id id = static_cast<Id>(spans_.size());
+    spans_.push_back({static_cast<std::uint32_t>(data_.size()),
+                      static_cast<std::uint32_t>(s.size())});
+    data_.append(s.data(), s.size());
+    stats_.bytes_stored += s.size();
+    slots_[slot] = id;
+    return id;
+  }
+
+  std::string_view view(Id id) const {
+    return std::string_view(data_).substr(spans_[id].offset, spans_[id].size);
+  }
+
+  /**
+   * @return offset of the string in data()
+   */
+  std::size_t offset(Id id) const { return spans_[id].offset; }
+
+  /**
+   * @return all strings of the pool, back to back
+   */
+  const std::string& data() const { return data_; }
+
+  std::size_t size() const { return spans_.size(); }
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  static constexpr Id kEmpty = UINT32_MAX;
+  static constexpr std::size_t kMaxSize = UINT32_MAX;  // offsets are 32-bit
+
+  struct Span {
+    std::uint32_t offset;
+    std::uint32_t size;
+  };
+
+  // slot holding the string, or the empty slot it has to go to
+  std::size_t probe(std::string_view s) const {
+    std::size_t mask = slots_.size() - 1;
+    std::size_t slot = hashKey(s) & mask;
+    while (slots_[slot] != kEmpty && view(slots_[slot]) != s) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void grow() {
+    std::vector<Id> slots(slots_.empty() ? 16 : 2 * slots_.size(), kEmpty);
+    slots_.swap(slots);
+    for (Id id = 0; id < spans_.size(); ++id) slots_[probe(view(id))] = id;
+  }
+
+  std::string data_;
+  std::vector<Span> spans_;
+  std::vector<Id> slots_;  // open addressing, load factor at most 1/2
+  Stats stats_;
+};
+
+}  // namespace ofp
+
+#endif  // OPTION_STRING_POOL_HPP
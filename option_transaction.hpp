@@ -0,0 +1,142 @@
+/**
+ * @file option_transaction.hpp
+ * @author Herwig Letofsky
+ * @brief atomic multi-key updates of an option file with optional
+ * preconditions. The file is locked only while the transaction is checked
+ * and applied, the new content replaces the file with a single rename, so
+ * readers see either the old or the new file and never a partial one.
+ *
+ *   ofp::Transaction txn;
+ *   txn.version = version_read_earlier;
+ *   txn.expected.emplace_back("rollout.stage", "canary");
+ *   txn.writes.emplace_back("rollout.stage", "full");
+ *   if (ofp::commitTransaction("service.conf", txn) ==
+ *       ofp::TransactionResult::conflict) {
+ *     // somebody else changed the file, read again and retry
+ *   }
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef OPTION_TRANSACTION_HPP
+#define OPTION_TRANSACTION_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "option_document.hpp"
+#include "option_file.hpp"
+#include "option_hash.hpp"
+#include "option_journal.hpp"
+
+namespace ofp {
+
+struct Transaction {
+  std::vector<std::pair<std::string, std::string>> writes;
+  std::vector<std::string> deletes;
+  // key has to hold the value, or has to be missing without a value
+  std::vector<std::pair<std::string, std::optional<std::string>>> expected;
+  // contentVersion() the file has to have
+  std::optional<std::uint64_t> version;
+};
+
+enum class TransactionResult : uint8_t { committed = 0x00, conflict, failed };
+
+/**
+ * @brief version of a file content, changes with every modification
+ */
+inline std::uint64_t contentVersion(std::string_view content) {
+  return contentHash(content);
+}
+
+/**
+ * @brief version of the edited content of the document
+ */
+inline std::uint64_t contentVersion(const Document& document) {
+  ContentHash hash;
+  document.forEachPiece([&hash](std::string_view piece) {
+    hash.update(piece);
+  });
+  return hash.digest();
+}
+
+namespace detail {
+
+inline bool readAll(int fd, std::string& content) {
+  content.clear();
+  char buffer[64 * 1024];
+  ssize_t result;
+  while ((result = ::read(fd, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, result);
+  }
+  return result == 0;
+}
+
+}  // namespace detail
+
+/**
+ * @brief checks the preconditions and applies all writes and deletes, or
+ * none of them
+ *
+ * @param version receives the version of the file after the transaction,
+ * or the current version if a precondition failed
+ */
+inline TransactionResult commitTransaction(const char* path,
+                                           const Transaction& txn,
+                                           std::uint64_t* version = nullptr) {
+  int fd = detail::openLocked(path);
+  if (fd < 0) return TransactionResult::failed;
+  std::string content;
+  if (!detail::readAll(fd, content)) {
+    ::close(fd);
+    return TransactionResult::failed;
+  }
+  if (version) *version = contentVersion(content);
+
+  bool satisfied = !txn.version || *txn.version == contentVersion(content);
+  Document document(content);
+  const std::vector<std::string_view>& lines = document.lines();
+  if (satisfied && !txn.expected.empty()) {
+    SectionIndex index(lines);
+    JournalState journal = readJournal(lines, journalStart(lines));
+    for (auto& expected : txn.expected) {
+      if (readValue(lines, index, journal, expected.first) !=
+          expected.second) {
+        satisfied = false;
+        break;
+      }
+    }
+  }
+  if (!satisfied) {
+    ::close(fd);
+    return TransactionResult::conflict;
+  }
+  if (txn.writes.empty() && txn.deletes.empty()) {
+    ::close(fd);
+    return TransactionResult::committed;
+  }
+
+  compactJournal(document, txn.writes, txn.deletes);
+  if (!document.modified()) {
+    ::close(fd);
+    return TransactionResult::committed;
+  }
+  bool replaced = replaceFile(path, document);
+  ::close(fd);  // releases the lock
+  if (!replaced) return TransactionResult::failed;
+  if (version) *version = contentVersion(document);
+  return TransactionResult::committed;
+}
+
+}  // namespace ofp
+
+#endif  // OPTION_TRANSACTION_HPP